@@ -1,58 +1,167 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * After changing buffer data, call bwrite to write it to disk,
+//     or bawrite to start the write and let go of the buffer;
+//     bwait waits for such a write to finish.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 //
-// The implementation uses two state flags internally:
+// The implementation uses three state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_ASYNC: the buffer's I/O was started by breadahead() or
+//     bawrite() and no process waits for it; ideintr() releases
+//     the buffer.
+// * B_ERROR: the disk failed the buffer's last request. A failed
+//     read leaves the buffer without B_VALID, so a failed
+//     read-ahead is simply tried again by the next bread().
+//
+// Buffers are hashed on (dev, blockno) into NBUCKET chains, each
+// with its own lock, so that lookups of different blocks do not
+// contend. A buffer's refcnt and chain links are protected by its
+// bucket's lock. A lookup also sets the buffer's referenced bit.
+// Recycling approximates LRU with CLOCK: a hand sweeps the ring
+// of all buffers and takes the first unused one that has not been
+// looked up since the hand last passed. Only recycling takes
+// bcache.lock, which serializes it and protects the hand.
+//
+// The number of buffers is fixed at boot from the amount of free
+// memory (1/BCACHEFRAC of it, but at least NBUF buffers).
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define NBUCKET 251
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;   // chain through next
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;   // serializes recycling
+  struct bucket bucket[NBUCKET];
+  struct buf *hand;       // clock hand on the ring of buffers
+  uint nbuf;
+  int nwait;              // processes recycling or waiting for a buffer
 } bcache;
 
+static struct bucket*
+bbucket(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct buf *b, *bufs;
+  char *mem;
+  uint i, nbuf;
 
   initlock(&bcache.lock, "bcache");
+  for(i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // Descriptors and data are carved out of whole pages,
+  // so the cache needs no contiguous allocation. Unused
+  // buffers start out in bucket 0 as block 0 of device 0,
+  // which bget is never asked for.
+  nbuf = kfreecount() / BCACHEFRAC * (PGSIZE / BSIZE);
+  if(nbuf < NBUF)
+    nbuf = NBUF;
+  bufs = 0;
+  mem = 0;
+  for(i = 0; i < nbuf; i++){
+    if(i % (PGSIZE / sizeof(*b)) == 0 && (bufs = (struct buf*)kalloc()) == 0)
+      break;
+    if(i % (PGSIZE / BSIZE) == 0 && (mem = kalloc()) == 0)
+      break;
+    b = &bufs[i % (PGSIZE / sizeof(*b))];
+    memset(b, 0, sizeof(*b));
+    b->data = (uchar*)mem + (i % (PGSIZE / BSIZE)) * BSIZE;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->next = bcache.bucket[0].head;
+    bcache.bucket[0].head = b;
+    b->cnext = bcache.hand;
+    bcache.hand = b;
+  }
+  if(i < NBUF)
+    panic("binit");
+  bcache.nbuf = i;
+  // Close the ring: the first buffer made is its last link.
+  for(b = bcache.hand; b->cnext; b = b->cnext)
+    ;
+  b->cnext = bcache.hand;
+}
+
+// Find an unused buffer to recycle, advancing the clock hand
+// past it. Returns it removed from its chain, or 0 if every
+// buffer is in use. Caller holds bcache.lock, so no one else
+// changes a buffer's block, and so its bucket, meanwhile.
+static struct buf*
+bvictim(void)
+{
+  struct bucket *bk;
+  struct buf *b, **pp;
+  uint n;
+
+  // Two turns clear every referenced bit on the way.
+  for(n = 0; n < 2*bcache.nbuf; n++){
+    b = bcache.hand;
+    bcache.hand = b->cnext;
+    bk = bbucket(b->dev, b->blockno);
+    acquire(&bk->lock);
+    // Even if refcnt==0, B_DIRTY indicates a buffer is in use
+    // because log.c has modified it but not yet committed it.
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      if(!b->referenced){
+        for(pp = &bk->head; *pp != b; pp = &(*pp)->next)
+          ;
+        *pp = b->next;
+        b->refcnt = 1;
+        release(&bk->lock);
+        return b;
+      }
+      b->referenced = 0;
+    }
+    release(&bk->lock);
+  }
+  return 0;
+}
+
+// Look in bucket bk for block blockno on device dev and take
+// a reference to it. Caller holds bk->lock.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      b->referenced = 1;
+      return b;
+    }
   }
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
@@ -61,35 +170,46 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
+  struct bucket *bk = bbucket(dev, blockno);
   struct buf *b;
 
-  acquire(&bcache.lock);
-
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
+  // Not cached; recycle an unused buffer. Someone may have
+  // brought the block in since we looked, so look again once
+  // no one else can be recycling.
+  acquire(&bcache.lock);
+  bcache.nwait++;
+  for(;;){
+    acquire(&bk->lock);
+    b = blookup(bk, dev, blockno);
+    release(&bk->lock);
+    if(b)
+      break;
+    if((b = bvictim()) != 0){
       b->dev = dev;
       b->blockno = blockno;
       b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      acquire(&bk->lock);
+      b->next = bk->head;
+      bk->head = b;
+      release(&bk->lock);
+      break;
     }
+    // Every buffer is in use: wait for a brelse().
+    sleep(&bcache, &bcache.lock);
   }
-  panic("bget: no buffers");
+  bcache.nwait--;
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -101,10 +221,39 @@ bread(uint dev, uint blockno)
   b = bget(dev, blockno);
   if((b->flags & B_VALID) == 0) {
     iderw(b);
+    // The file system has no way to go on without the block.
+    if(b->flags & B_ERROR)
+      panic("bread: disk error");
   }
   return b;
 }
 
+// Start reading a block into the cache and return without
+// waiting, unless it is cached or on its way already. A later
+// bread() of the block waits for the read to finish.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct bucket *bk = bbucket(dev, blockno);
+  struct buf *b;
+
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  release(&bk->lock);
+  if(b)
+    return;
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  b->flags |= B_ASYNC;
+  iderw(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -113,32 +262,72 @@ bwrite(struct buf *b)
     panic("bwrite");
   b->flags |= B_DIRTY;
   iderw(b);
+  if(b->flags & B_ERROR)
+    panic("bwrite: disk error");
+}
+
+// Start writing b's contents to disk and return without waiting.
+// Must be locked; the caller gives up the buffer as if by brelse,
+// which ideintr() does for it once the write is done.
+void
+bawrite(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bawrite");
+  b->flags |= B_DIRTY|B_ASYNC;
+  iderw(b);
+}
+
+// Wait for I/O on a block, e.g. a write started by bawrite(),
+// to finish. Returns at once if the block is not cached.
+void
+bwait(uint dev, uint blockno)
+{
+  struct bucket *bk = bbucket(dev, blockno);
+  struct buf *b;
+
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if(b == 0)
+    return;
+  acquiresleep(&b->lock);
+  brelse(b);
 }
 
 // Release a locked buffer.
-// Move to the head of the MRU list.
 void
 brelse(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("brelse");
+  bdone(b);
+}
+
+// Release a buffer whose B_ASYNC I/O has finished. Called
+// from ideintr(), which is not the holder of the buffer's
+// lock in the holdingsleep() sense.
+void
+bdone(struct buf *b)
+{
+  struct bucket *bk;
+  int unused;
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bbucket(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  unused = (b->refcnt == 0 && (b->flags & B_DIRTY) == 0);
+  release(&bk->lock);
+
+  // bget() counts itself in nwait before it looks for a free
+  // buffer, so either it sees this one or we see it waiting.
+  if(unused && bcache.nwait > 0){
+    acquire(&bcache.lock);
+    wakeup(&bcache);
+    release(&bcache.lock);
   }
-  
-  release(&bcache.lock);
 }
 //PAGEBREAK!
 // Blank page.
-
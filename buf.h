@@ -4,11 +4,15 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  struct buf *next;  // hash chain
+  struct buf *cnext; // ring of all buffers, for the clock hand
+  int referenced;    // looked up since the clock hand passed
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  uint qtime;        // ticks when queued, for the I/O scheduler
+  uchar *data;       // BSIZE bytes
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // no one waits for the I/O; ideintr releases the buffer
+#define B_ERROR 0x10 // the disk failed the last request
 
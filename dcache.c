@@ -0,0 +1,137 @@
+// Directory entry cache.
+//
+// Remembers the results of dirlookup(), indexed by (dev,
+// directory inum, name): the inum and offset of the entry, or
+// that the directory has no such entry (inum 0). namex() walks
+// hot paths such as "/", the current directory and the /.swapN
+// files without reading directories through the block layer.
+//
+// The cache is set-associative: a name hashes to one set of
+// NDWAY entries, and a new entry replaces the least recently
+// used one in its set.
+//
+// Every change to a directory goes through dirlink() or an
+// unlink, which update the entry for the name, so entries never
+// go stale. When a directory is freed its entries are dropped,
+// since its inum may be reused.
+//
+// Callers hold the directory's sleep-lock; dcache.lock only
+// protects the table.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NDSET 128
+#define NDWAY 4
+
+struct dentry {
+  uint dev;
+  uint dinum;          // directory
+  char name[DIRSIZ];
+  uint inum;           // 0: no such entry
+  uint off;            // byte offset of the entry in the directory
+  uint used;           // clock at last use, 0 if the slot is empty
+};
+
+struct {
+  struct spinlock lock;
+  uint clock;
+  struct dentry set[NDSET][NDWAY];
+} dcache;
+
+void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry*
+dcset(struct inode *dp, char *name)
+{
+  uint h;
+  int i;
+
+  h = dp->dev * 31 + dp->inum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + name[i];
+  return dcache.set[h % NDSET];
+}
+
+// Find the entry for name in dp. Caller holds dcache.lock.
+static struct dentry*
+dcfind(struct dentry *set, struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  for(d = set; d < set+NDWAY; d++)
+    if(d->used && d->dev == dp->dev && d->dinum == dp->inum &&
+       namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Look name up in directory dp. Returns 1 and sets *inum
+// (0 if dp has no entry for name) and *off if the answer is
+// cached, 0 if it is not.
+int
+dclookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dcset(dp, name), dp, name)) != 0){
+    d->used = ++dcache.clock;
+    *inum = d->inum;
+    *off = d->off;
+  }
+  release(&dcache.lock);
+  return d != 0;
+}
+
+// Record that name in dp is inum at offset off,
+// or that there is no such entry if inum is 0.
+void
+dcenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *set, *d, *e;
+
+  acquire(&dcache.lock);
+  set = dcset(dp, name);
+  if((d = dcfind(set, dp, name)) == 0){
+    // Take an empty slot, or else the least recently used.
+    d = set;
+    for(e = set; e < set+NDWAY; e++){
+      if(e->used == 0){
+        d = e;
+        break;
+      }
+      if(e->used - d->used > 0x80000000)
+        d = e;
+    }
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+  }
+  d->inum = inum;
+  d->off = off;
+  d->used = ++dcache.clock;
+  release(&dcache.lock);
+}
+
+// Drop all entries of directory dp, which is being freed.
+void
+dcpurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = &dcache.set[0][0]; d < &dcache.set[0][0] + NDSET*NDWAY; d++)
+    if(d->used && d->dev == dp->dev && d->dinum == dp->inum)
+      d->used = 0;
+  release(&dcache.lock);
+}
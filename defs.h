@@ -2,6 +2,10 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct ioqueue;
+struct lockstat;
+struct lockstats;
+struct page;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -9,12 +13,18 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
+struct shmseg;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
+void            bdone(struct buf*);
 void            bwrite(struct buf*);
+void            bawrite(struct buf*);
+void            bwait(uint, uint);
+void            breadahead(uint, uint);
 
 // console.c
 void            consoleinit(void);
@@ -22,6 +32,12 @@ void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 
+// dcache.c
+void            dcinit(void);
+int             dclookup(struct inode*, char*, uint*, uint*);
+void            dcenter(struct inode*, char*, uint, uint);
+void            dcpurge(struct inode*);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -50,18 +66,26 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+char*           readipage(struct inode*, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 int             createSwapFile(struct proc* p);
 int             readFromSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size);
 int             writeToSwapFile(struct proc* p, char* buffer, uint placeOnFile, uint size);
 int             removeSwapFile(struct proc* p);
+void            prefetchSwapFile(struct proc* p, uint placeOnFile, uint size);
 
 
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+int             idebusy(void);
+
+// iosched.c
+void            ioqadd(struct ioqueue*, struct buf*);
+struct buf*     ioqnext(struct ioqueue*, int);
+int             ioqsetsched(struct ioqueue*, char*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -73,6 +97,9 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+uint            kfreecount(void);
+int             krefcount(char*);
+void            kincref(char*);
 
 // kbd.c
 void            kbdintr(void);
@@ -100,6 +127,25 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pci.c
+struct pcidev;
+uint            pciread(struct pcidev*, int);
+void            pciwrite(struct pcidev*, int, uint);
+int             pcifind(int, int, int, int, struct pcidev*);
+uint            pcibar(struct pcidev*, int);
+void            pcienable(struct pcidev*, int);
+
+// pcache.c
+void            pcinit(void);
+struct page*    pcget(uint, uint, uint);
+void            pcput(struct page*);
+void            pcwrite(uint, uint, uint, char*, uint);
+char*           pcshare(struct page*);
+void            pcinval(uint, uint, uint);
+void            pcdirty(uint, uint, uint);
+char*           pcclean(uint, uint, uint);
+int             pcreclaim(void);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
@@ -113,6 +159,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+struct proc*    kthread(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -121,13 +168,17 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
+void            idlesleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
+int             schedtick(void);
+void            suspend(void);
 void            memSwapInfo(struct proc*);
 int             isUserProc(struct proc*);
 void            clockInterruptUpdate();
+void            setpgbusy(struct proc*, int);
 struct proc*    getProcFromPgdir(pde_t *pgdir);
 
 // swtch.S
@@ -138,8 +189,20 @@ struct inode*   create(char *path, short type, short major, short minor);
 int             isdirempty(struct inode *dp);
 
 
+// shm.c
+void            shminit(void);
+int             shmget(int, uint);
+int             shmat(int);
+int             shmdt(uint);
+void            shmdup(struct shmseg*);
+void            shmrelease(struct shmseg*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
+int             getlockstat(struct lockstat*, int);
+struct lockstats* lockstatsfor(char*, int);
+void            lockacquired(struct lockstats*, uint64, uint);
+void            lockreleased(struct lockstats*, uint64);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
@@ -184,6 +247,12 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// virtio.c
+void            virtioinit(void);
+int             virtiorw(struct buf*);
+int             virtiointr(int);
+int             virtiobusy(void);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -196,11 +265,24 @@ void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
+void            switchuvmfast(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 void            printPagingInfo(struct proc*);
-void            swapIn(uint); 
+int             swapIn(uint);
+int             suspendOut(struct proc*);
+int             suspendIn(struct proc*);
+extern uint     nfaults;
+struct vma*     findvma(struct proc*, uint);
+int             reserveuvm(pde_t*, uint, uint, int);
+int             mmapfile(struct inode*, uint, uint, int, int);
+int             pagein(uint, uint, int);
+int             mmapIn(uint);
+int             munmapfile(struct proc*, uint, uint);
+void            munmapall(struct proc*);
+int             mapsegment(struct proc*, struct shmseg*);
+void            unmapsegment(struct proc*, struct vma*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -6,14 +6,16 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "fcntl.h"
 
 int exec(char *path, char **argv) {
   char *s, *last;
-  int i, off;
+  int i, off, nvma;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vmas[NVMA], *v;
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
@@ -26,6 +28,7 @@ int exec(char *path, char **argv) {
   }
   ilock(ip);
   pgdir = 0;
+  nvma = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -51,6 +54,11 @@ int exec(char *path, char **argv) {
   for( int i=0; i<MAX_PSYC_PAGES; i++ ) curproc->pagesAge[i] = 0;
   curproc->verbose = 0;
 
+  // A segment whose file offset is page aligned is not read here:
+  // its pages are filled in from the file on first touch, like an
+  // mmap() region (see mmapIn in vm.c), and read-only pages share
+  // the page cache's frames. Other segments are loaded up front.
+  memset(vmas, 0, sizeof(vmas));
   sz = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
@@ -61,10 +69,28 @@ int exec(char *path, char **argv) {
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(ph.off % PGSIZE == 0 && nvma < NVMA &&
+       ph.vaddr >= PGROUNDUP(sz) && ph.vaddr + ph.memsz <= MMAPBASE){
+      if(ph.vaddr > sz && allocuvm(pgdir, sz, ph.vaddr) == 0)
+        goto bad;
+      v = &vmas[nvma];
+      v->prot = PROT_READ | ((ph.flags & ELF_PROG_FLAG_WRITE) ? PROT_WRITE : 0);
+      if(reserveuvm(pgdir, ph.vaddr, PGROUNDUP(ph.vaddr + ph.memsz), v->prot) < 0)
+        goto bad;
+      v->start = ph.vaddr;
+      v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+      v->off = ph.off;
+      v->filesz = ph.filesz;
+      v->flags = MAP_PRIVATE;
+      v->ip = idup(ip);
+      nvma++;
+      sz = ph.vaddr + ph.memsz;
+      continue;
+    }
+    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+      goto bad;
     if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
@@ -109,6 +135,8 @@ int exec(char *path, char **argv) {
     goto bad;
 
   // Commit to the user image.
+  munmapall(curproc);
+  memmove(curproc->vmas, vmas, sizeof(vmas));
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
@@ -125,5 +153,10 @@ int exec(char *path, char **argv) {
     iunlockput(ip);
     end_op();
   }
+  for(i = 0; i < nvma; i++){
+    begin_op();
+    iput(vmas[i].ip);
+    end_op();
+  }
   return -1;
 }
@@ -5,6 +5,8 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
@@ -92,6 +94,37 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// User memory is copied to and from a file a page at a time
+// through a kernel buffer. A page fault on it can then be taken
+// with no inode lock and no transaction held: the page may be
+// a mapping of this very file, and mmapIn() takes its lock.
+static int
+bounceread(struct file *f, char *addr, int n)
+{
+  char *buf;
+  int r, m, tot;
+
+  if((buf = kalloc()) == 0)
+    return -1;
+  for(tot = 0; tot < n; ){
+    m = n - tot < PGSIZE ? n - tot : PGSIZE;
+    ilock(f->ip);
+    if((r = readi(f->ip, buf, f->off, m)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    if(r < 0 && tot == 0)
+      tot = -1;
+    if(r <= 0)
+      break;
+    memmove(addr + tot, buf, r);
+    tot += r;
+    if(r < m)  // end of file, or a device's short read
+      break;
+  }
+  kfree(buf);
+  return tot;
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
@@ -103,11 +136,14 @@ fileread(struct file *f, char *addr, int n)
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
-    return r;
+    if((uint)addr >= KERNBASE){
+      ilock(f->ip);
+      if((r = readi(f->ip, addr, f->off, n)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+      return r;
+    }
+    return bounceread(f, addr, n);
   }
   panic("fileread");
 }
@@ -126,20 +162,35 @@ filewrite(struct file *f, char *addr, int n)
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // i-node, indirect and double-indirect blocks,
+    // allocation blocks, and 2 blocks of slop for
+    // non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    int max = ((MAXOPBLOCKS-1-1-1-2) / 2) * BSIZE;
     int i = 0;
+    char *src, *buf = 0;
+
+    // user memory goes through a kernel buffer, see bounceread().
+    if((uint)addr < KERNBASE){
+      if((buf = kalloc()) == 0)
+        return -1;
+      if(max > PGSIZE)
+        max = PGSIZE;
+    }
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
+      src = addr + i;
+      if(buf){
+        memmove(buf, src, n1);
+        src = buf;
+      }
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
+      if ((r = writei(f->ip, src, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
@@ -150,6 +201,8 @@ filewrite(struct file *f, char *addr, int n)
         panic("short filewrite");
       i += r;
     }
+    if(buf)
+      kfree(buf);
     return i == n ? n : -1;
   }
   panic("filewrite");
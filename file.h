@@ -16,15 +16,24 @@ struct inode {
   int ref;            // Reference count
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  int flags;          // I_NOCACHE
+  uint ranext;        // block a sequential reader reads next
+  uint raend;         // first block not yet read ahead
+  uint lastblock;     // block allocated last, where balloc looks next
+  struct inode *hnext;  // icache hash chain
+  struct inode *lprev;  // icache LRU list, while ref is 0
+  struct inode *lnext;
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
 
+#define I_NOCACHE 0x1  // bypass the page cache (swap files)
+
 // table mapping major device number to
 // device functions
 struct devsw {
@@ -20,9 +20,11 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "pcache.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static uint bmap(struct inode*, uint);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -51,30 +53,228 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// balloc() is given a goal, the block after the one the file
+// allocated last, and returns the first free block at or after
+// it, so that a file's blocks are laid out in order. Files with
+// no goal start where the last such search left off (the rotor)
+// rather than at block 0.
+//
+// An in-memory summary counts the free blocks in each group of
+// BGROUP blocks, so searches skip full groups without looking
+// at the bitmap. The count for a group changes only while its
+// bitmap block is locked; searches read it without a lock, as a
+// hint.
+//
+// A file that is being written sequentially, such as a swap
+// file, holds a reservation on the NRSVBLOCKS blocks after its
+// last block; other files allocate around reservations while
+// there is room elsewhere. Reservations live only in memory and
+// are dropped when the inode leaves the cache or is truncated.
+
+#define BGROUP     1024  // blocks per summary group
+#define NRSV          8  // files holding reservations at once
+#define NRSVBLOCKS   32  // blocks reserved ahead of a sequential writer
+
+struct reservation {
+  uint dev;
+  uint inum;
+  uint start;   // blocks [start, end) are held for the file
+  uint end;
+};
+
+// Block allocation summary and reservations.
+struct {
+  struct spinlock lock;          // protects rotor and rsv
+  ushort *nfree;                 // free blocks in each group
+  uint ngroup;
+  uint rotor;                    // where goalless searches start
+  struct reservation rsv[NRSV];
+  uint rsvnext;                  // slot to take when all are in use
+} bsum;
+
+// Build the free block summary from the bitmap.
+static void
+bsuminit(uint dev)
+{
+  struct buf *bp;
+  uint b;
+
+  initlock(&bsum.lock, "balloc");
+  bsum.ngroup = (sb.size + BGROUP - 1) / BGROUP;
+  if(bsum.ngroup * sizeof(ushort) > PGSIZE ||
+     (bsum.nfree = (ushort*)kalloc()) == 0)
+    panic("bsuminit");
+  memset(bsum.nfree, 0, PGSIZE);
+  bp = 0;
+  for(b = 0; b < sb.size; b++){
+    if(b % BPB == 0){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, BBLOCK(b, sb));
+    }
+    if((bp->data[(b % BPB)/8] & (1 << (b % 8))) == 0)
+      bsum.nfree[b / BGROUP]++;
+  }
+  if(bp)
+    brelse(bp);
+}
+
+// Copy the reservations held for files other than ip into
+// held[NRSV], so that a search can test blocks against them
+// without taking bsum.lock for each one. Returns the count.
+static int
+bothers(struct inode *ip, struct reservation *held)
+{
+  struct reservation *r;
+  int n = 0;
+
+  acquire(&bsum.lock);
+  for(r = bsum.rsv; r < bsum.rsv+NRSV; r++){
+    if(r->end != 0 && (r->dev != ip->dev || r->inum != ip->inum))
+      held[n++] = *r;
+  }
+  release(&bsum.lock);
+  return n;
+}
+
+// Is block b in one of the n reservations in held?
+static int
+breserved(struct reservation *held, int n, uint b)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(b >= held[i].start && b < held[i].end)
+      return 1;
+  }
+  return 0;
+}
+
+// Hold the NRSVBLOCKS blocks after b for ip.
+static void
+breserve(struct inode *ip, uint b)
+{
+  struct reservation *r, *slot;
+
+  acquire(&bsum.lock);
+  slot = 0;
+  for(r = bsum.rsv; r < bsum.rsv+NRSV; r++){
+    if(r->end != 0 && r->dev == ip->dev && r->inum == ip->inum){
+      slot = r;
+      break;
+    }
+    if(slot == 0 && r->end == 0)
+      slot = r;
+  }
+  if(slot == 0)
+    slot = &bsum.rsv[bsum.rsvnext++ % NRSV];
+  slot->dev = ip->dev;
+  slot->inum = ip->inum;
+  slot->start = b + 1;
+  slot->end = min(b + 1 + NRSVBLOCKS, sb.size);
+  release(&bsum.lock);
+}
+
+// Drop ip's reservation, if it has one.
+static void
+bunreserve(struct inode *ip)
+{
+  struct reservation *r;
 
-// Allocate a zeroed disk block.
+  acquire(&bsum.lock);
+  for(r = bsum.rsv; r < bsum.rsv+NRSV; r++){
+    if(r->end != 0 && r->dev == ip->dev && r->inum == ip->inum)
+      r->start = r->end = 0;
+  }
+  release(&bsum.lock);
+}
+
+// Take the first free block in [from, to) for ip, skipping
+// blocks in the nheld reservations in held. Returns 0 if there
+// is none; block 0 is the boot block, never free.
 static uint
-balloc(uint dev)
+bfind(struct inode *ip, uint from, uint to,
+      struct reservation *held, int nheld)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, bi;
+  int m;
 
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
+  for(b = from; b < to; ){
+    if(bsum.nfree[b / BGROUP] == 0){
+      b = (b / BGROUP + 1) * BGROUP;
+      continue;
+    }
+    if(bp == 0 || bp->blockno != BBLOCK(b, sb)){
+      if(bp)
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      bp = bread(ip->dev, BBLOCK(b, sb));
+    }
+    bi = b % BPB;
+    if(bp->data[bi/8] == 0xff){  // Skip 8 blocks in use.
+      b = (b | 7) + 1;
+      continue;
+    }
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0 && !breserved(held, nheld, b)){
+      bp->data[bi/8] |= m;  // Mark block in use.
+      log_write(bp);
+      bsum.nfree[b / BGROUP]--;
+      brelse(bp);
+      return b;
     }
+    b++;
+  }
+  if(bp)
     brelse(bp);
+  return 0;
+}
+
+// Allocate a zeroed disk block for inode ip, near the
+// block it allocated last.
+static uint
+balloc(struct inode *ip)
+{
+  struct reservation held[NRSV];
+  uint b, goal;
+  int nheld;
+
+  // An inode just read from disk has no lastblock; append after
+  // its real last block. writei never leaves holes, so the
+  // block below ip->size exists and bmap does not allocate.
+  if(ip->lastblock == 0 && ip->size > 0)
+    ip->lastblock = bmap(ip, (ip->size - 1) / BSIZE);
+  if(ip->lastblock != 0 && ip->lastblock + 1 < sb.size)
+    goal = ip->lastblock + 1;
+  else {
+    acquire(&bsum.lock);
+    goal = bsum.rotor;
+    release(&bsum.lock);
   }
-  panic("balloc: out of blocks");
+
+  // Wrap around once; then give up on reservations.
+  nheld = bothers(ip, held);
+  for(;;){
+    if((b = bfind(ip, goal, sb.size, held, nheld)) != 0 ||
+       (b = bfind(ip, 0, goal, held, nheld)) != 0 || nheld == 0)
+      break;
+    nheld = 0;
+  }
+  if(b == 0)
+    panic("balloc: out of blocks");
+
+  if(ip->lastblock != 0)
+    breserve(ip, b);
+  else {
+    acquire(&bsum.lock);
+    bsum.rotor = b + 1;
+    release(&bsum.lock);
+  }
+  ip->lastblock = b;
+  bzero(ip->dev, b);
+  return b;
 }
 
 // Free a disk block.
@@ -91,6 +291,7 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  bsum.nfree[b / BGROUP]++;
   brelse(bp);
 }
 
@@ -105,12 +306,20 @@ bfree(int dev, uint b)
 // sb.startinode. Each inode has a number, indicating its
 // position on the disk.
 //
-// The kernel keeps a cache of in-use inodes in memory
+// The kernel keeps a cache of inodes in memory
 // to provide a place for synchronizing access
 // to inodes used by multiple processes. The cached
 // inodes include book-keeping information that is
 // not stored on disk: ip->ref and ip->valid.
 //
+// The cache is hashed on (dev, inum). Its entries are carved
+// from pages allocated as it grows, up to a limit set at boot
+// from free memory and the number of inodes on the disk. An
+// entry whose ref falls to zero keeps its contents and goes on
+// an LRU list; iget() of the same inode takes it back without
+// reading the disk, and once the cache is at its limit new
+// inodes reuse the least recently used entry.
+//
 // An inode and its in-memory representation go through a
 // sequence of states before they can be used by the
 // rest of the file system code.
@@ -120,7 +329,7 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
+//   can be reused if ip->ref is zero. Otherwise ip->ref tracks
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
@@ -130,7 +339,7 @@ bfree(int dev, uint b)
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -155,34 +364,99 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// entries, the hash chains and the LRU list. Since ip->ref
+// indicates whether an entry is free, and ip->dev and ip->inum
+// indicate which i-node an entry holds, one must hold
+// icache.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 251
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];  // chains through hnext
+  struct inode *lruhead;       // unreferenced, least recently used first
+  struct inode *lrutail;
+  struct inode *free;          // entries never used yet
+  uint ninode;                 // entries holding an inode
+  uint maxinode;               // entries to have before reusing
 } icache;
 
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &icache.hash[(dev * 31 + inum) % NIHASH];
+}
+
+// Take ip off the LRU list. Caller holds icache.lock.
+static void
+lruremove(struct inode *ip)
+{
+  if(ip->lprev)
+    ip->lprev->lnext = ip->lnext;
+  else
+    icache.lruhead = ip->lnext;
+  if(ip->lnext)
+    ip->lnext->lprev = ip->lprev;
+  else
+    icache.lrutail = ip->lprev;
+  ip->lprev = ip->lnext = 0;
+}
+
+// A cache entry for a new inode: a fresh one while the cache
+// may grow, else the least recently used unreferenced one.
+// Returns 0 if there is none. Caller holds icache.lock.
+static struct inode*
+inew(void)
+{
+  struct inode *ip, **pp;
+  int i;
+
+  if(icache.ninode < icache.maxinode || icache.lruhead == 0){
+    if(icache.free == 0 && (ip = (struct inode*)kalloc()) != 0){
+      for(i = 0; i < PGSIZE / sizeof(*ip); i++){
+        memset(&ip[i], 0, sizeof(ip[i]));
+        initsleeplock(&ip[i].lock, "inode");
+        ip[i].hnext = icache.free;
+        icache.free = &ip[i];
+      }
+    }
+    if((ip = icache.free) != 0){
+      icache.free = ip->hnext;
+      icache.ninode++;
+      return ip;
+    }
+  }
+
+  if((ip = icache.lruhead) == 0)
+    return 0;
+  lruremove(ip);
+  for(pp = ihash(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+    ;
+  *pp = ip->hnext;
+  return ip;
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
+  uint n;
+
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
 
   readsb(dev, &sb);
+  n = kfreecount() / ICACHEFRAC * (PGSIZE / sizeof(struct inode));
+  icache.maxinode = n < sb.ninodes ? n : sb.ninodes;
+  if(icache.maxinode < NINODE)
+    icache.maxinode = NINODE;
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
           sb.bmapstart);
+  bsuminit(dev);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -241,31 +515,39 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  pp = ihash(dev, inum);
+  for(ip = *pp; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        lruremove(ip);
+        if(!ip->valid)   // freed since; start afresh
+          goto fresh;
+      }
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
   // Recycle an inode cache entry.
-  if(empty == 0)
+  if((ip = inew()) == 0)
     panic("iget: no inodes");
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = *pp;
+  *pp = ip;
+fresh:
+  ip->flags = 0;
+  ip->ranext = 0;
+  ip->raend = 0;
+  ip->lastblock = 0;
   release(&icache.lock);
 
   return ip;
@@ -338,6 +620,8 @@ iput(struct inode *ip)
     release(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcpurge(ip);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
@@ -347,8 +631,19 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  int unused = (--ip->ref == 0);
+  if(unused){
+    // Keep the contents; most recently used at the tail.
+    ip->lprev = icache.lrutail;
+    if(icache.lrutail)
+      icache.lrutail->lnext = ip;
+    else
+      icache.lruhead = ip;
+    icache.lrutail = ip;
+  }
   release(&icache.lock);
+  if(unused)
+    bunreserve(ip);
 }
 
 // Common idiom: unlock, then put.
@@ -365,7 +660,9 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT].  The NDINDIRECT blocks
+// after that are listed in indirect blocks, which are in turn
+// listed in the double-indirect block ip->addrs[NDIRECT+1].
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -377,7 +674,7 @@ bmap(struct inode *ip, uint bn)
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip);
     return addr;
   }
   bn -= NDIRECT;
@@ -385,11 +682,34 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = balloc(ip);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+      a[bn] = addr = balloc(ip);
+      log_write(bp);
+    }
+    brelse(bp);
+    return addr;
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load the double-indirect block, then the indirect
+    // block under it, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip);
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    if((addr = a[bn / NINDIRECT]) == 0){
+      a[bn / NINDIRECT] = addr = balloc(ip);
+      log_write(bp);
+    }
+    brelse(bp);
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    if((addr = a[bn % NINDIRECT]) == 0){
+      a[bn % NINDIRECT] = addr = balloc(ip);
       log_write(bp);
     }
     brelse(bp);
@@ -407,9 +727,9 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i, j, k;
+  struct buf *bp, *bp2;
+  uint *a, *a2;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -430,6 +750,29 @@ itrunc(struct inode *ip)
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+    a = (uint*)bp->data;
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j] == 0)
+        continue;
+      bp2 = bread(ip->dev, a[j]);
+      a2 = (uint*)bp2->data;
+      for(k = 0; k < NINDIRECT; k++){
+        if(a2[k])
+          bfree(ip->dev, a2[k]);
+      }
+      brelse(bp2);
+      bfree(ip->dev, a[j]);
+    }
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
+  bunreserve(ip);
+  ip->lastblock = 0;
+  pcinval(ip->dev, ip->inum, PGROUNDUP(ip->size) / PGSIZE);
   ip->size = 0;
   iupdate(ip);
 }
@@ -446,14 +789,61 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Called before reading block bn of ip. While the file is read
+// sequentially, keep the next NREADAHEAD blocks on their way
+// into the buffer cache, so the disk works while the caller
+// copies. Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint b, end;
+
+  // Reading the same block again (small reads) still counts.
+  if(bn != ip->ranext && bn + 1 != ip->ranext){
+    ip->ranext = ip->raend = bn + 1;
+    return;
+  }
+  ip->ranext = bn + 1;
+  if(ip->raend < bn + 1)
+    ip->raend = bn + 1;
+  end = min(bn + 1 + NREADAHEAD, (ip->size + BSIZE - 1) / BSIZE);
+  for(b = ip->raend; b < end; b++)
+    breadahead(ip->dev, bmap(ip, b));
+  if(end > ip->raend)
+    ip->raend = end;
+}
+
+// Fill data with page pgno of ip from the buffer cache.
+// Whatever lies past the end of the file reads as zero.
+// Caller must hold ip->lock.
+static void
+pagefill(struct inode *ip, char *data, uint pgno)
+{
+  uint off;
+  struct buf *bp;
+
+  for(off = 0; off < PGSIZE; off += BSIZE){
+    if(pgno*PGSIZE + off >= ip->size){
+      memset(data + off, 0, PGSIZE - off);
+      break;
+    }
+    readahead(ip, (pgno*PGSIZE + off)/BSIZE);
+    bp = bread(ip->dev, bmap(ip, (pgno*PGSIZE + off)/BSIZE));
+    memmove(data + off, bp->data, BSIZE);
+    brelse(bp);
+  }
+}
+
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
+// File pages are served from the page cache when it has room.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  struct page *pg;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -467,6 +857,18 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if(!(ip->flags & I_NOCACHE) &&
+       (pg = pcget(ip->dev, ip->inum, off/PGSIZE)) != 0){
+      if(!pg->valid){
+        pagefill(ip, pg->data, off/PGSIZE);
+        pg->valid = 1;
+      }
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      memmove(dst, pg->data + off%PGSIZE, m);
+      pcput(pg);
+      continue;
+    }
+    readahead(ip, off/BSIZE);
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
@@ -475,6 +877,29 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// Return the page cache frame holding page pgno of ip, with a
+// reference for the caller to map (see mmapIn).
+// Caller must hold ip->lock. Returns 0 if the page cannot
+// be cached.
+char*
+readipage(struct inode *ip, uint pgno)
+{
+  struct page *pg;
+  char *mem;
+
+  if(ip->type == T_DEV || (ip->flags & I_NOCACHE))
+    return 0;
+  if((pg = pcget(ip->dev, ip->inum, pgno)) == 0)
+    return 0;
+  if(!pg->valid){
+    pagefill(ip, pg->data, pgno);
+    pg->valid = 1;
+  }
+  mem = pcshare(pg);
+  pcput(pg);
+  return mem;
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
@@ -492,7 +917,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if((off + n) / BSIZE > MAXFILE)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
@@ -500,6 +925,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
+    pcwrite(ip->dev, ip->inum, off, src, m);
     brelse(bp);
   }
 
@@ -530,6 +956,14 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dclookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -540,10 +974,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcenter(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -573,6 +1009,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcenter(dp, name, inum, off);
 
   return 0;
 }
@@ -741,6 +1178,7 @@ removeSwapFile(struct proc* p)
 	memset(&de, 0, sizeof(de));
 	if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
 		panic("unlink: writei");
+	dcenter(dp, name, 0, 0);
 	if(ip->type == T_DIR){
 		dp->nlink--;
 		iupdate(dp);
@@ -774,6 +1212,7 @@ createSwapFile(struct proc* p)
 
     begin_op();
     struct inode * in = create(path, T_FILE, 0, 0);
+	in->flags |= I_NOCACHE;
 	iunlock(in);
 
 	p->swapFile = filealloc();
@@ -800,6 +1239,21 @@ writeToSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size)
 
 }
 
+//start reading size bytes at placeOnFile into the buffer cache,
+//all at once; the readFromSwapFile calls that follow find them there
+void
+prefetchSwapFile(struct proc * p, uint placeOnFile, uint size)
+{
+	struct inode *ip = p->swapFile->ip;
+	uint b, end;
+
+	ilock(ip);
+	end = min(placeOnFile + size, ip->size);
+	for(b = placeOnFile / BSIZE; b * BSIZE < end; b++)
+		breadahead(ip->dev, bmap(ip, b));
+	iunlock(ip);
+}
+
 //return as sys_read (-1 when error)
 int
 readFromSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size)
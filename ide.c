@@ -1,4 +1,6 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code. Transfers use bus-master DMA when the
+// controller supports it (PIIX and compatibles, found on the PCI
+// bus), and programmed I/O otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +14,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
+#include "iosched.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,15 +27,44 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_IDENTIFY 0xec
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+// Bus master registers of the primary channel, from bmbase.
+#define BM_CMD        0     // command
+#define BM_STATUS     2     // status
+#define BM_PRDT       4     // physical address of the PRD table
+#define BM_START      0x01  // command: start transfer
+#define BM_READ       0x08  // command: device to memory
+#define BM_ERR        0x02  // status: error (write 1 to clear)
+#define BM_INTR       0x04  // status: interrupt (write 1 to clear)
+
+// Physical region descriptor: one contiguous piece of a transfer.
+// A block's data never crosses a page, so one per block does.
+struct prd {
+  uint addr;
+  ushort count;
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last descriptor of the table
+
+// ideactive points to the bufs now being read/written to the
+// disk: one buf, or with DMA up to IOMAXMERGE bufs for consecutive
+// blocks, chained through qnext. idequeue holds the bufs waiting
+// for the disk; iosched.c decides which go next.
+// You must hold idelock while manipulating either.
 
 static struct spinlock idelock;
-static struct buf *idequeue;
+static struct buf *ideactive;
+static struct ioqueue idequeue;
 
 static int havedisk1;
+static uint disksize[2]; // in blocks, from IDENTIFY DEVICE
+static ushort bmbase;    // bus master I/O base, 0 for PIO
+// The table may not cross a 64KB boundary; within a page it can't.
+static struct prd prdt[IOMAXMERGE] __attribute__((aligned(PGSIZE)));
 static void idestart(struct buf*);
 
 // Wait for IDE disk to become ready.
@@ -47,12 +80,42 @@ idewait(int checkerr)
   return 0;
 }
 
+// Have READ/WRITE MULTIPLE on disk move a whole block
+// per interrupt.
+static void
+idesetmult(int disk)
+{
+  idewait(0);
+  outb(0x1f6, 0xe0 | (disk<<4));
+  outb(0x1f2, BSIZE/SECTOR_SIZE);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  idewait(0);
+}
+
+// The size of disk in blocks, from IDENTIFY DEVICE.
+static uint
+ideidentify(int disk)
+{
+  uint id[SECTOR_SIZE/4];
+
+  idewait(0);
+  outb(0x1f6, 0xe0 | (disk<<4));
+  outb(0x1f7, IDE_CMD_IDENTIFY);
+  if(idewait(1) < 0)
+    return 0;
+  insl(0x1f0, id, SECTOR_SIZE/4);
+  return id[30] / (BSIZE/SECTOR_SIZE);  // words 60-61: LBA28 sectors
+}
+
 void
 ideinit(void)
 {
   int i;
+  struct pcidev d;
 
   initlock(&idelock, "ide");
+  if(ioqsetsched(&idequeue, IOSCHED) < 0)
+    panic("ideinit: iosched");
   ioapicenable(IRQ_IDE, ncpu - 1);
   idewait(0);
 
@@ -65,33 +128,77 @@ ideinit(void)
     }
   }
 
+  if(BSIZE > SECTOR_SIZE){
+    idesetmult(0);
+    if(havedisk1)
+      idesetmult(1);
+  }
+  disksize[0] = ideidentify(0);
+  if(havedisk1)
+    disksize[1] = ideidentify(1);
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  // Use DMA if the controller can be a bus master
+  // (bit 7 of its programming interface).
+  if(pcifind(PCI_ANY, PCI_ANY, PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &d) == 0 &&
+     (d.progif & 0x80)){
+    pcienable(&d, PCI_CMD_IO|PCI_CMD_MASTER);
+    bmbase = pcibar(&d, 4);
+  }
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b and the bufs chained behind it.
+// Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *m;
+  int n;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
+  n = 0;
+  for(m = b; m; m = m->qnext){
+    if(m->blockno >= disksize[m->dev & 1])
+      panic("incorrect blockno");
+    if(bmbase){
+      prdt[n].addr = V2P(m->data);
+      prdt[n].count = BSIZE;
+      prdt[n].flags = m->qnext ? 0 : PRD_EOT;
+    }
+    n++;
+  }
+  if(bmbase){
+    outb(bmbase+BM_CMD, 0);
+    outl(bmbase+BM_PRDT, V2P(prdt));
+    outb(bmbase+BM_STATUS, BM_ERR|BM_INTR);
+  }
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, n * sector_per_block);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(bmbase){
+    // The controller moves the data; the CPU is free
+    // until the interrupt.
+    if(b->flags & B_DIRTY){
+      outb(0x1f7, IDE_CMD_WRDMA);
+      outb(bmbase+BM_CMD, BM_START);
+    } else {
+      outb(0x1f7, IDE_CMD_RDDMA);
+      outb(bmbase+BM_CMD, BM_START|BM_READ);
+    }
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
     outsl(0x1f0, b->data, BSIZE/4);
   } else {
@@ -103,63 +210,107 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *next, *async;
+  int err;
 
-  // First queued buffer is the active request.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if((b = ideactive) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+  // Read data if needed. With DMA it is in memory already;
+  // stop the engine and clear its status. Either the
+  // controller or the drive may report a failure.
+  err = 0;
+  if(bmbase){
+    outb(bmbase+BM_CMD, 0);
+    if(inb(bmbase+BM_STATUS) & BM_ERR)
+      err = 1;
+    outb(bmbase+BM_STATUS, BM_ERR|BM_INTR);
+  }
+  if(idewait(1) < 0)
+    err = 1;
+  else if(!bmbase && !(b->flags & B_DIRTY))
     insl(0x1f0, b->data, BSIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Wake processes waiting for these bufs. Keep the
+  // asynchronous ones on a list of our own.
+  async = 0;
+  for(; b; b = next){
+    next = b->qnext;
+    if(b->flags & B_ASYNC){
+      b->qnext = async;
+      async = b;
+    }
+    if(err)
+      b->flags |= B_ERROR;
+    else
+      b->flags |= B_VALID;
+    b->flags &= ~(B_DIRTY|B_ASYNC);
+    wakeup(b);
+  }
 
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  // Start disk on the next request.
+  if((ideactive = ioqnext(&idequeue, bmbase ? IOMAXMERGE : 1)) != 0)
+    idestart(ideactive);
 
   release(&idelock);
+
+  // No one waits for an asynchronous request; give the
+  // buffers back to the cache.
+  for(; async; async = next){
+    next = async->qnext;
+    bdone(async);
+  }
+}
+
+// Is a disk request in progress? Sampled by the swapper,
+// without the lock.
+int
+idebusy(void)
+{
+  return ideactive != 0 || virtiobusy();
 }
 
 //PAGEBREAK!
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, return at once; ideintr releases the
+// buffer when the disk is done with it.
+// If the disk fails the request, set B_ERROR instead of B_VALID.
 void
 iderw(struct buf *b)
 {
-  struct buf **pp;
-
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
+  b->flags &= ~B_ERROR;
+  if(virtiorw(b) == 0)
+    return;
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  ioqadd(&idequeue, b);  //DOC:insert-queue
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(ideactive == 0){
+    ideactive = ioqnext(&idequeue, bmbase ? IOMAXMERGE : 1);
+    idestart(ideactive);
+  }
+
+  if(b->flags & B_ASYNC){
+    release(&idelock);
+    return;
+  }
 
   // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+  while(!(b->flags & B_ERROR) && (b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
 
@@ -0,0 +1,164 @@
+// I/O schedulers for the IDE driver. Each queue has its own,
+// chosen by name with ioqsetsched(); it starts with IOSCHED.
+//
+// noop sends requests to the disk one at a time in the order
+// they were queued, as xv6 always has.
+//
+// elevator is a C-LOOK elevator with a deadline. The disk head
+// sweeps up through the block numbers, serving the nearest
+// request at or past it, and goes back to the lowest request
+// when there is nothing further on. Requests that a process is
+// waiting for (page faults, read(), log commits) go ahead of
+// write-behind and read-ahead, which no one is waiting for yet;
+// but a request that has waited IODEADLINE ticks goes first, so
+// neither the sweep nor the waiting requests can starve it. The
+// chosen request takes along queued requests for the blocks
+// after it in the same direction, so the driver can move them
+// in one command.
+//
+// The driver owns the queue and the lock protecting it.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "iosched.h"
+
+// Is a process waiting for b?
+static int
+issync(struct buf *b)
+{
+  return (b->flags & B_ASYNC) == 0;
+}
+
+// Does a come before b on the disk?
+static int
+before(struct buf *a, struct buf *b)
+{
+  return a->dev < b->dev || (a->dev == b->dev && a->blockno < b->blockno);
+}
+
+// The next request in the sweep, counting only synchronous
+// requests if synconly is set. Returns 0 if there is none.
+static struct buf*
+clook(struct ioqueue *q, int synconly)
+{
+  struct buf *b, *next, *low;
+
+  next = low = 0;
+  for(b = q->head; b; b = b->qnext){
+    if(synconly && !issync(b))
+      continue;
+    if((b->dev > q->dev || (b->dev == q->dev && b->blockno >= q->blockno)) &&
+       (next == 0 || before(b, next)))
+      next = b;
+    if(low == 0 || before(b, low))
+      low = b;
+  }
+  return next ? next : low;
+}
+
+static struct buf*
+noop(struct ioqueue *q)
+{
+  return q->head;
+}
+
+static struct buf*
+elevator(struct ioqueue *q)
+{
+  struct buf *b;
+
+  // The oldest request is at the head; go on with the sweep
+  // unless it is overdue.
+  b = q->head;
+  if(ticks - b->qtime < IODEADLINE){
+    if((b = clook(q, 1)) == 0)
+      b = clook(q, 0);
+  }
+  return b;
+}
+
+static struct iosched scheds[] = {
+  { "noop",     noop,     0 },
+  { "elevator", elevator, 1 },
+};
+
+// Make q use the scheduler called name. Caller holds the
+// driver's lock once the queue is in use. Returns -1 if there
+// is no such scheduler.
+int
+ioqsetsched(struct ioqueue *q, char *name)
+{
+  struct iosched *s;
+
+  for(s = scheds; s < &scheds[NELEM(scheds)]; s++){
+    if(strncmp(s->name, name, 16) == 0){
+      q->sched = s;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static void
+ioqremove(struct ioqueue *q, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &q->head; *pp != b; pp = &(*pp)->qnext)
+    ;
+  *pp = b->qnext;
+}
+
+// Queue b for the disk.
+void
+ioqadd(struct ioqueue *q, struct buf *b)
+{
+  struct buf **pp;
+
+  b->qtime = ticks;
+  b->qnext = 0;
+  for(pp = &q->head; *pp; pp = &(*pp)->qnext)
+    ;
+  *pp = b;
+}
+
+// Take the next request to send to the disk off q, with up to
+// max-1 requests for the blocks after it chained behind it
+// through qnext. Returns 0 if q is empty.
+struct buf*
+ioqnext(struct ioqueue *q, int max)
+{
+  struct buf *b, *m, *last;
+  int n;
+
+  if(q->head == 0)
+    return 0;
+  b = q->sched->pick(q);
+  if(!q->sched->merge)
+    max = 1;
+  ioqremove(q, b);
+
+  last = b;
+  for(n = 1; n < max; n++){
+    for(m = q->head; m; m = m->qnext){
+      if(m->dev == last->dev && m->blockno == last->blockno + 1 &&
+         (m->flags & B_DIRTY) == (b->flags & B_DIRTY))
+        break;
+    }
+    if(m == 0)
+      break;
+    ioqremove(q, m);
+    last->qnext = m;
+    last = m;
+  }
+  last->qnext = 0;
+
+  q->dev = last->dev;
+  q->blockno = last->blockno + 1;
+  return b;
+}
@@ -0,0 +1,23 @@
+// I/O scheduler: the order in which queued disk requests
+// are sent to the disk.
+
+#define IOSCHED "elevator"  // scheduler a queue starts with
+
+#define IODEADLINE   50  // ticks a request may wait before it goes first
+#define IOMAXMERGE    8  // most blocks in one disk command
+
+struct ioqueue;
+
+// A scheduling policy.
+struct iosched {
+  char *name;
+  struct buf *(*pick)(struct ioqueue*);  // next request; queue not empty
+  int merge;         // send following blocks along with it?
+};
+
+struct ioqueue {
+  struct buf *head;  // waiting requests in arrival order, through qnext
+  uint dev;          // disk head position: just past the
+  uint blockno;      //   last request sent to the disk
+  struct iosched *sched;
+};
@@ -1,6 +1,11 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
 // and pipe buffers. Allocates 4096-byte pages.
+//
+// Every allocated page has a reference count so that a frame
+// can be mapped by several address spaces (shared memory).
+// kalloc() returns a page with one reference, kincref() adds
+// one, and kfree() only frees the page when the last one goes.
 
 #include "types.h"
 #include "defs.h"
@@ -21,6 +26,8 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  uint nfree;       // pages on freelist
+  ushort ref[PHYSTOP/PGSIZE];  // references to each allocated page
 } kmem;
 
 // Initialization happens in two phases.
@@ -52,10 +59,11 @@ freerange(void *vstart, void *vend)
     kfree(p);
 }
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
+// (The exception is when initializing the allocator;
+// see kinit above.)
 void
 kfree(char *v)
 {
@@ -64,6 +72,18 @@ kfree(char *v)
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(kmem.ref[V2P(v)/PGSIZE] > 1){
+    kmem.ref[V2P(v)/PGSIZE]--;
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    return;
+  }
+  kmem.ref[V2P(v)/PGSIZE] = 0;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
@@ -72,25 +92,63 @@ kfree(char *v)
   r = (struct run*)v;
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
   if(kmem.use_lock)
     release(&kmem.lock);
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
-// Returns 0 if the memory cannot be allocated.
+// Returns 0 if the memory cannot be allocated, even after
+// reclaiming page cache frames.
 char*
 kalloc(void)
 {
   struct run *r;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
-  return (char*)r;
+  for(;;){
+    if(kmem.use_lock)
+      acquire(&kmem.lock);
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.nfree--;
+      kmem.ref[V2P(r)/PGSIZE] = 1;
+    }
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    // Out of memory: take a frame back from the page cache.
+    if(r || !kmem.use_lock || pcreclaim() == 0)
+      return (char*)r;
+  }
+}
+
+// Add a reference to an allocated page.
+void
+kincref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kincref");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[V2P(v)/PGSIZE] < 1)
+    panic("kincref: free page");
+  kmem.ref[V2P(v)/PGSIZE]++;
+  release(&kmem.lock);
+}
+
+// Number of references to an allocated page. Without a lock:
+// the caller must know that it cannot go from 1 to more meanwhile.
+int
+krefcount(char *v)
+{
+  return kmem.ref[V2P(v)/PGSIZE];
+}
+
+// Number of free pages, for sizing caches.
+uint
+kfreecount(void)
+{
+  return kmem.nfree;
 }
 
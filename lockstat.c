@@ -0,0 +1,91 @@
+// Print the kernel lock profile, locks waited for longest first.
+//
+//   lockstat             since boot
+//   lockstat cmd args    while cmd runs
+//
+// Times are in units of 1024 cycles. Call sites are kernel
+// addresses (see kernel.asm) and count since boot either way.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "lockstat.h"
+
+#define NLOCKS 64
+
+// Print s and pad it with blanks to w characters.
+void
+pad(char *s, int w)
+{
+  int n;
+
+  n = strlen(s);
+  printf(1, "%s", s);
+  while(n++ < w)
+    printf(1, " ");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct lockstat *before, *after, *l;
+  int order[NLOCKS];
+  int i, j, k, m, n, pid;
+
+  before = malloc(NLOCKS * sizeof(struct lockstat));
+  after = malloc(NLOCKS * sizeof(struct lockstat));
+  if(before == 0 || after == 0){
+    printf(2, "lockstat: out of memory\n");
+    exit();
+  }
+
+  m = 0;
+  if(argc > 1){
+    m = getlockstat(before, NLOCKS);
+    pid = fork();
+    if(pid < 0){
+      printf(2, "lockstat: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      printf(2, "lockstat: exec %s failed\n", argv[1]);
+      exit();
+    }
+    wait();
+  }
+  n = getlockstat(after, NLOCKS);
+
+  // Names stay in their places; new ones come after.
+  for(i = 0; i < m && i < n; i++){
+    after[i].nacquire -= before[i].nacquire;
+    after[i].ncontend -= before[i].ncontend;
+    after[i].kwait -= before[i].kwait;
+    after[i].khold -= before[i].khold;
+  }
+
+  // Sort by waiting time.
+  for(i = 0; i < n; i++){
+    for(j = i; j > 0 && after[order[j-1]].kwait < after[i].kwait; j--)
+      order[j] = order[j-1];
+    order[j] = i;
+  }
+
+  pad("lock", 17);
+  printf(1, "kind   acquire contend kwait khold\n");
+  for(i = 0; i < n; i++){
+    l = &after[order[i]];
+    if(l->nacquire == 0)
+      continue;
+    pad(l->name, 17);
+    printf(1, "%s %d %d %d %d\n", l->sleep ? "sleep " : "spin  ",
+           l->nacquire, l->ncontend, l->kwait, l->khold);
+    for(k = 0; k < NLOCKSITE; k++){
+      if(l->site[k].pc == 0)
+        continue;
+      printf(1, "    at 0x%x: %d waits, %d\n",
+             l->site[k].pc, l->site[k].n, l->site[k].kwait);
+    }
+  }
+  exit();
+}
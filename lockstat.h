@@ -0,0 +1,19 @@
+// Lock profile, as returned by getlockstat(). Locks of the
+// same name count together: all pipes have one entry, all
+// buffer cache buckets another. Times are rdtsc cycles, in
+// units of 1024.
+#define NLOCKSITE 4  // call sites kept per lock name
+
+struct lockstat {
+  char name[16];
+  int sleep;         // A sleep-lock, not a spinlock
+  uint nacquire;     // Acquisitions
+  uint ncontend;     // Acquisitions that had to wait
+  uint kwait;        // Time spent waiting
+  uint khold;        // Time held
+  struct {
+    uint pc;         // Caller of acquire(), 0 if unused
+    uint n;          // Contended acquisitions from there
+    uint kwait;      // and their waiting time
+  } site[NLOCKSITE]; // The call sites that waited most
+};
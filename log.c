@@ -21,59 +21,98 @@
 // sleeps until the last outstanding end_op() commits.
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+// The on-disk log (sb.nlog blocks, set by mkfs) is split in two
+// areas, each of the form:
+//   header block, containing a sequence number and
+//     block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Successive transactions use the two areas in turn, so that a
+// new transaction can commit while the flusher kernel thread is
+// still installing the previous one at the blocks' home
+// locations. Recovery installs what it finds in sequence order.
+//
+// Commit copies the transaction's blocks into the log buffers
+// and starts writing them, and only then lets new operations
+// begin: they join the next transaction while this one waits
+// for its log writes and writes its header. If that next
+// transaction is ready to commit while the disk is still busy
+// with this one, it waits, and operations that begin meanwhile
+// join it too, so that one commit covers all of them.
+
+#define LOGMAX (BSIZE/sizeof(int) - 2)  // most blocks a header can name
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  uint seq;
+  int block[LOGMAX];
+};
+
+// One of the two areas of the on-disk log.
+struct logarea {
+  int start;            // header block; data blocks follow
+  int busy;             // holds a transaction not yet installed
+  int committed;        // its header is on disk
+  struct logheader lh;
 };
 
 struct log {
   struct spinlock lock;
-  int start;
-  int size;
+  int size;        // data blocks in each area
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int committing;  // copying into the log, please wait.
+  int writing;     // a commit is waiting for the disk.
   int dev;
+  uint seq;        // sequence number of the open transaction
+  uint iseq;       // sequence number of the next to install
   struct logheader lh;
+  struct logarea area[2];
+  struct buf shadow;    // flusher's buffer outside the cache
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void flusher(void);
 
 void
 initlog(int dev)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
   initlock(&log.lock, "log");
   readsb(dev, &sb);
-  log.start = sb.logstart;
-  log.size = sb.nlog;
+  log.area[0].start = sb.logstart;
+  log.area[1].start = sb.logstart + sb.nlog/2;
+  log.size = sb.nlog/2 - 1;
+  if (log.size > LOGMAX)
+    log.size = LOGMAX;
+  if (log.size < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = dev;
   recover_from_log();
+
+  initsleeplock(&log.shadow.lock, "shadow");
+  if((log.shadow.data = (uchar*)kalloc()) == 0 ||
+     kthread("flusher", flusher) == 0)
+    panic("initlog: flusher");
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log area a to their home location
 static void
-install_trans(void)
+install_trans(struct logarea *a)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
+  for (tail = 0; tail < a->lh.n; tail++) {
+    struct buf *lbuf = bread(log.dev, a->start+tail+1); // read log block
+    struct buf *dbuf = bread(log.dev, a->lh.block[tail]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
     brelse(lbuf);
@@ -81,32 +120,36 @@ install_trans(void)
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the header of log area a from disk
 static void
-read_head(void)
+read_head(struct logarea *a)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(log.dev, a->start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  a->lh.n = lh->n;
+  a->lh.seq = lh->seq;
+  if (a->lh.n < 0 || a->lh.n > log.size)
+    a->lh.n = 0;
+  for (i = 0; i < a->lh.n; i++) {
+    a->lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write the header of log area a to disk.
 // This is the true point at which the
-// current transaction commits.
+// transaction in it commits.
 static void
-write_head(void)
+write_head(struct logarea *a)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(log.dev, a->start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = a->lh.n;
+  hb->seq = a->lh.seq;
+  for (i = 0; i < a->lh.n; i++) {
+    hb->block[i] = a->lh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -115,10 +158,108 @@ write_head(void)
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct logarea *a0 = &log.area[0], *a1 = &log.area[1];
+
+  read_head(a0);
+  read_head(a1);
+  // if committed, copy from log to disk, older first
+  if (a0->lh.n > 0 && a1->lh.n > 0 && a1->lh.seq - a0->lh.seq > 0x80000000) {
+    install_trans(a1);
+    install_trans(a0);
+  } else {
+    install_trans(a0);
+    install_trans(a1);
+  }
+  a0->lh.n = a1->lh.n = 0;
+  write_head(a0); // clear the log
+  write_head(a1);
+}
+
+// Is blockno part of a transaction newer than the one the
+// flusher is installing?
+static int
+inlog(uint blockno)
+{
+  struct logarea *a = &log.area[(log.iseq+1) % 2];
+  int i, found = 0;
+
+  acquire(&log.lock);
+  for (i = 0; i < log.lh.n; i++) {
+    if (log.lh.block[i] == blockno) {
+      found = 1;
+      break;
+    }
+  }
+  for (i = 0; a->busy && !found && i < a->lh.n; i++) {
+    if (a->lh.block[i] == blockno)
+      found = 1;
+  }
+  release(&log.lock);
+  return found;
+}
+
+// Install the committed transaction in area a at the blocks'
+// home locations. New operations may run meanwhile, so a cached
+// block can hold newer data. Holding its buffer locked keeps
+// it from being modified and logged; if it is not in a newer
+// transaction, the cached data is the committed data and is
+// written straight from the cache. Otherwise the committed
+// copy is written from the log through log.shadow, and the
+// cached block stays dirty for the newer transaction.
+static void
+install_committed(struct logarea *a)
+{
+  int tail;
+  struct buf *dbuf, *lbuf;
+
+  for (tail = 0; tail < a->lh.n; tail++) {
+    dbuf = bread(log.dev, a->lh.block[tail]);
+    if (!inlog(dbuf->blockno)) {
+      bawrite(dbuf);
+      continue;
+    }
+    lbuf = bread(log.dev, a->start+tail+1);
+    acquiresleep(&log.shadow.lock);
+    memmove(log.shadow.data, lbuf->data, BSIZE);
+    log.shadow.dev = log.dev;
+    log.shadow.blockno = dbuf->blockno;
+    log.shadow.flags = B_DIRTY;
+    iderw(&log.shadow);
+    releasesleep(&log.shadow.lock);
+    brelse(lbuf);
+    brelse(dbuf);
+  }
+  for (tail = 0; tail < a->lh.n; tail++)
+    bwait(log.dev, a->lh.block[tail]);
+}
+
+// Kernel thread that installs each transaction, in order, once
+// it has committed, then erases it from the log.
+static void
+flusher(void)
+{
+  struct logarea *a;
+
+  acquire(&log.lock);
+  for(;;){
+    a = &log.area[log.iseq % 2];
+    while(!a->committed)
+      sleep(&log.area, &log.lock);
+    release(&log.lock);
+
+    install_committed(a);
+
+    acquire(&log.lock);
+    a->lh.n = 0;
+    release(&log.lock);
+    write_head(a);
+
+    acquire(&log.lock);
+    a->committed = 0;
+    a->busy = 0;
+    log.iseq++;
+    wakeup(&log);
+  }
 }
 
 // called at the start of each FS system call.
@@ -129,7 +270,7 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.size){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
@@ -152,8 +293,15 @@ end_op(void)
   if(log.committing)
     panic("log.committing");
   if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+    // Let the previous commit finish first. Operations that
+    // begin meanwhile join this transaction, and then the
+    // last of them to end commits it.
+    while(log.outstanding == 0 && (log.committing || log.writing))
+      sleep(&log, &log.lock);
+    if(log.outstanding == 0 && log.lh.n > 0){
+      do_commit = 1;
+      log.committing = 1;
+    }
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -166,39 +314,63 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log area a and start
+// writing them.
 static void
-write_log(void)
+write_log(struct logarea *a)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+  for (tail = 0; tail < a->lh.n; tail++) {
+    struct buf *to = bread(log.dev, a->start+tail+1); // log block
+    struct buf *from = bread(log.dev, a->lh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    bawrite(to);  // start writing the log
     brelse(from);
-    brelse(to);
   }
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
-  }
+  struct logarea *a = &log.area[log.seq % 2];
+  int tail;
+
+  // The area still holds the transaction before last
+  // until the flusher is done with it.
+  acquire(&log.lock);
+  while (a->busy)
+    sleep(&log, &log.lock);
+  a->lh = log.lh;
+  a->lh.seq = log.seq++;
+  a->busy = 1;
+  log.lh.n = 0;
+  release(&log.lock);
+
+  write_log(a);        // Copy modified blocks from cache to log
+
+  // The log buffers hold this transaction now; new
+  // operations may modify the cached blocks.
+  acquire(&log.lock);
+  log.committing = 0;
+  log.writing = 1;
+  wakeup(&log);
+  release(&log.lock);
+
+  for (tail = 0; tail < a->lh.n; tail++)
+    bwait(log.dev, a->start+tail+1);
+  write_head(a);       // Write header to disk -- the real commit
+
+  // Hand the transaction to the flusher to install.
+  acquire(&log.lock);
+  a->committed = 1;
+  log.writing = 0;
+  wakeup(&log.area);
+  wakeup(&log);
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -215,7 +387,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.size)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -231,4 +403,3 @@ log_write(struct buf *b)
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
-
@@ -28,11 +28,15 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
-  binit();         // buffer cache
   fileinit();      // file table
+  shminit();       // shared memory segments
   ideinit();       // disk 
+  virtioinit();    // virtio disk, if any
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  binit();         // buffer cache, sized from free memory
+  pcinit();        // page cache, sized from free memory
+  dcinit();        // directory entry cache
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -13,7 +13,7 @@
 #include "fs.h"
 #include "buf.h"
 
-extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
+extern uchar _binary_memfs_img_start[], _binary_memfs_img_size[];
 
 static int disksize;
 static uchar *memdisk;
@@ -21,8 +21,8 @@ static uchar *memdisk;
 void
 ideinit(void)
 {
-  memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/BSIZE;
+  memdisk = _binary_memfs_img_start;
+  disksize = (uint)_binary_memfs_img_size/BSIZE;
 }
 
 // Interrupt handler.
@@ -32,9 +32,17 @@ ideintr(void)
   // no-op
 }
 
+// Copies are synchronous: the disk is never busy.
+int
+idebusy(void)
+{
+  return 0;
+}
+
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// The copy is synchronous, so a B_ASYNC buffer is released here.
 void
 iderw(struct buf *b)
 {
@@ -57,4 +65,8 @@ iderw(struct buf *b)
   } else
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
+  if(b->flags & B_ASYNC){
+    b->flags &= ~B_ASYNC;
+    bdone(b);
+  }
 }
@@ -15,20 +15,22 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 200       // fewest inodes
+#define BLOCKSPERINODE 8  // more inodes on bigger disks
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
+uint fssize = FSSIZE;  // Size of the image in blocks (-s)
+uint ninodes;
+int nbitmap;
+int ninodeblocks;
 int nlog = LOGSIZE;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
@@ -76,8 +78,13 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc > 3 && strcmp(argv[1], "-s") == 0){
+    fssize = atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-s blocks] fs.img files...\n");
     exit(1);
   }
 
@@ -90,25 +97,39 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  // 1 fs block = 1 disk sector
+  // 1 fs block = BSIZE/512 disk sectors
+  ninodes = fssize / BLOCKSPERINODE;
+  if(ninodes < NINODES)
+    ninodes = NINODES;
+  if(ninodes > 0xffff)   // dirent.inum is a ushort
+    ninodes = 0xffff;
+  ninodeblocks = ninodes / IPB + 1;
+  nbitmap = fssize/(BSIZE*8) + 1;
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  if(fssize <= nmeta){
+    fprintf(stderr, "mkfs: %u blocks is too small\n", fssize);
+    exit(1);
+  }
+  nblocks = fssize - nmeta;
 
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
+  // The image starts out all zeroes, without writing them.
+  if(ftruncate(fsfd, (off_t)fssize * BSIZE) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
@@ -260,7 +281,7 @@ iappend(uint inum, void *xp, int n)
   struct dinode din;
   char buf[BSIZE];
   uint indirect[NINDIRECT];
-  uint x;
+  uint x, y, i;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -273,7 +294,7 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
@@ -283,6 +304,24 @@ iappend(uint inum, void *xp, int n)
         wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
+    } else {
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
+      }
+      rsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      i = (fbn - NDIRECT - NINDIRECT) / NINDIRECT;
+      if(indirect[i] == 0){
+        indirect[i] = xint(freeblock++);
+        wsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      }
+      y = xint(indirect[i]);
+      rsect(y, (char*)indirect);
+      i = (fbn - NDIRECT - NINDIRECT) % NINDIRECT;
+      if(indirect[i] == 0){
+        indirect[i] = xint(freeblock++);
+        wsect(y, (char*)indirect);
+      }
+      x = xint(indirect[i]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -0,0 +1,90 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define PAGES 16
+
+int main(int argc, char * argv[]) {
+    int fd, *map, success = 1;
+    int page[1024];
+
+    if( argc==2 ) verbose(atoi(argv[1]));
+
+    // Build a file of PAGES pages; word j of page i holds i*1024+j.
+    fd = open("mmapfile", O_CREATE|O_RDWR);
+    for( int i=0; i<PAGES; i++ ) {
+        for( int j=0; j<1024; j++ ) page[j] = i*1024 + j;
+        write(fd, page, sizeof(page));
+    }
+    close(fd);
+
+    // Private read-only scan: more pages than MAX_PSYC_PAGES,
+    // so clean file pages have to be dropped along the way.
+    fd = open("mmapfile", O_RDONLY);
+    map = (int*) mmap(0, PAGES*4096, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    for( int i=0; i<PAGES*1024; i++ ) {
+        if( map[i] != i ) success = 0;
+    }
+    munmap(map, PAGES*4096);
+    printf(1, "Private Read: %s\n", success ? "Successful" : "Failed");
+
+    // Shared stores show up in read() at once, and reach the
+    // file after munmap.
+    fd = open("mmapfile", O_RDWR);
+    map = (int*) mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 4096);
+    for( int i=0; i<2*1024; i++ ) map[i] = -map[i];
+    read(fd, page, sizeof(page));
+    read(fd, page, sizeof(page));
+    for( int j=0; j<1024; j++ ) {
+        if( page[j] != -(1024 + j) ) success = 0;
+    }
+    munmap(map, 2*4096);
+    close(fd);
+    fd = open("mmapfile", O_RDONLY);
+    read(fd, page, sizeof(page));
+    read(fd, page, sizeof(page));
+    read(fd, page, sizeof(page));
+    for( int j=0; j<1024; j++ ) {
+        if( page[j] != -(2*1024 + j) ) success = 0;
+    }
+    close(fd);
+    printf(1, "Shared Write: %s\n", success ? "Successful" : "Failed");
+
+    // A parent and child share the frames of a shared mapping,
+    // and a read-only one sees a later write().
+    fd = open("mmapfile", O_RDWR);
+    map = (int*) mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 4096);
+    if( fork()==0 ) {
+        map[0] = 7;
+        exit();
+    }
+    wait();
+    if( map[0] != 7 ) success = 0;
+    munmap(map, 4096);
+    map = (int*) mmap(0, 4096, PROT_READ, MAP_SHARED, fd, 0);
+    page[0] = 9;
+    write(fd, page, sizeof(int));
+    if( map[0] != 9 ) success = 0;
+    munmap(map, 4096);
+    close(fd);
+    printf(1, "Shared Fork: %s\n", success ? "Successful" : "Failed");
+
+    // Mappings are inherited across fork.
+    fd = open("mmapfile", O_RDONLY);
+    map = (int*) mmap(0, 4096, PROT_READ, MAP_PRIVATE, fd, 3*4096);
+    close(fd);
+    if( fork()==0 ) {
+        for( int j=0; j<1024; j++ ) {
+            if( map[j] != 3*1024 + j ) success = 0;
+        }
+        printf(1, "Child Read: %s\n", success ? "Successful" : "Failed");
+        exit();
+    }
+    wait();
+    munmap(map, 4096);
+
+    unlink("mmapfile");
+    exit();
+}
@@ -96,7 +96,10 @@ struct segdesc {
 #define PTE_U           0x004   // User
 #define PTE_PS          0x080   // Page Size
 #define PTE_A           0x020   // Accessed
+#define PTE_D           0x040   // Dirty
 #define PTE_PG          0x200   // Paged out to secondary storage
+#define PTE_MM          0x400   // Backed by a memory-mapped file
+#define PTE_SH          0x800   // Frame shared with other address spaces
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
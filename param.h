@@ -1,14 +1,28 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define NLOCKSTAT    64  // lock names with contention statistics
+#define NPRIO         4  // scheduling levels
+#define BOOSTTICKS  100  // ticks between moving all processes to level 0
+#define SWAPWINDOW   10  // ticks over which the swapper measures paging
+#define THRASHFAULTS 20  // disk page faults per window that mean thrashing
+#define SUSPENDMAX  500  // ticks a process stays suspended at most
+#define IDLETICKS   300  // ticks asleep before a process is swapped out whole
 #define NOFILE       16  // open files per process
+#define NVMA          8  // mmap regions per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // minimum size of the i-node cache
+#define ICACHEFRAC  256  // i-node cache may take 1/ICACHEFRAC of free memory
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*12) // blocks in on-disk log (two areas)
+#define NBUF         (LOGSIZE*2)  // minimum size of disk block cache
+#define BCACHEFRAC   32  // disk block cache takes 1/BCACHEFRAC of free memory
+#define FSSIZE       2000  // default size of file system in blocks (mkfs -s)
+#define PCACHEFRAC   4  // page cache may hold 1/PCACHEFRAC of free memory
+#define NREADAHEAD   16  // blocks read ahead of a sequential reader
+#define NSHM         16  // shared memory segments system-wide
+#define SHMMAXPAGES  16  // pages per shared memory segment
 
@@ -0,0 +1,321 @@
+// Page cache.
+//
+// Holds whole PGSIZE pages of file content, indexed by
+// (dev, inum, page number), so that hot files are served from
+// memory instead of going back through the small block cache.
+// readi() copies out of it and writei() writes through to it;
+// the disk copy is still updated through the log, so apart from
+// pages stored to through shared mappings (below) the page cache
+// never holds the only copy of any data.
+//
+// The cache may grow to a share of free memory fixed at boot.
+// Pages are replaced by CLOCK: the pages holding a frame form a
+// ring, and a hand sweeps it, giving a page that has been looked
+// up since the hand last passed a second chance. When kalloc()
+// runs out of memory it takes frames back the same way, so file
+// pages and process memory compete for the same frames.
+//
+// A frame can also be handed to processes to map (pcshare(), used
+// for program text and MAP_SHARED mappings). It stays the cache's
+// copy of the page, so write() and read() see the same bytes as
+// the mappings, and it is not replaced while any page table still
+// holds a reference to it. A process that drops a dirty shared
+// mapping of the page marks it dirty (pcdirty()); munmap() writes
+// dirty pages back to the file (pcclean()), and until then they
+// are not replaced either.
+//
+// Callers must hold the inode's sleep-lock around pcget()/pcput(),
+// which is what serializes filling a page with other users of it.
+// pcache.lock only protects the table itself.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "pcache.h"
+
+#define NPCHASH 1024
+
+struct {
+  struct spinlock lock;
+  struct page *hash[NPCHASH];
+  struct page *free;  // unused descriptors
+  struct page *hand;  // clock hand on the ring of pages in use
+  uint npages;        // frames currently held
+  uint maxpages;      // frames the cache may hold
+} pcache;
+
+static uint
+pchash(uint dev, uint inum, uint pgno)
+{
+  return (dev * 31 + inum * 1009 + pgno) % NPCHASH;
+}
+
+void
+pcinit(void)
+{
+  struct page *pg;
+  char *mem;
+  int i;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.maxpages = kfreecount() / PCACHEFRAC;
+
+  // Descriptors are carved out of whole pages, so the
+  // table needs no contiguous allocation.
+  for(i = 0; i < pcache.maxpages; i += PGSIZE / sizeof(*pg)){
+    if((mem = kalloc()) == 0)
+      break;
+    memset(mem, 0, PGSIZE);
+    for(pg = (struct page*)mem; pg + 1 <= (struct page*)(mem + PGSIZE); pg++){
+      pg->next = pcache.free;
+      pcache.free = pg;
+    }
+  }
+}
+
+static struct page*
+pclookup(uint dev, uint inum, uint pgno)
+{
+  struct page *pg;
+
+  for(pg = pcache.hash[pchash(dev, inum, pgno)]; pg; pg = pg->hnext)
+    if(pg->dev == dev && pg->inum == inum && pg->pgno == pgno)
+      return pg;
+  return 0;
+}
+
+static void
+pcunhash(struct page *pg)
+{
+  struct page **pp;
+
+  for(pp = &pcache.hash[pchash(pg->dev, pg->inum, pg->pgno)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == pg){
+      *pp = pg->hnext;
+      return;
+    }
+  }
+  panic("pcunhash");
+}
+
+// Forget what pg holds, keeping its frame.
+static void
+pcforget(struct page *pg)
+{
+  if(pg->inum)
+    pcunhash(pg);
+  pg->valid = 0;
+  pg->dirty = 0;
+  pg->dev = pg->inum = pg->pgno = 0;
+  pg->hnext = 0;
+}
+
+// Choose an unpinned page to give up its frame, advancing the
+// clock hand past it. Pages that processes map, or that hold
+// stores not yet written back, stay. Returns 0 if every page
+// has to stay.
+static struct page*
+pcvictim(void)
+{
+  struct page *pg;
+  uint n;
+
+  // Two turns clear every referenced bit on the way.
+  for(n = 0; n < 2*pcache.npages; n++){
+    pg = pcache.hand;
+    pcache.hand = pg->next;
+    if(pg->ref > 0 || pg->dirty || krefcount(pg->data) > 1)
+      continue;
+    if(pg->referenced && pg->inum){
+      pg->referenced = 0;
+      continue;
+    }
+    return pg;
+  }
+  return 0;
+}
+
+// Return the page for page pgno of the file, pinned.
+// If pg->valid is 0 the caller must fill pg->data and set it.
+// Returns 0 if every frame is pinned or memory is short;
+// the caller then reads through the block cache.
+struct page*
+pcget(uint dev, uint inum, uint pgno)
+{
+  struct page *pg;
+  char *data;
+
+  acquire(&pcache.lock);
+  if((pg = pclookup(dev, inum, pgno)) != 0){
+    pg->ref++;
+    pg->referenced = 1;
+    release(&pcache.lock);
+    return pg;
+  }
+
+  data = 0;
+  if(pcache.npages < pcache.maxpages && pcache.free && (data = kalloc()) != 0){
+    pg = pcache.free;
+    pcache.free = pg->next;
+    // Join the ring just behind the hand.
+    if(pcache.hand == 0){
+      pg->next = pg->prev = pg;
+      pcache.hand = pg;
+    } else {
+      pg->next = pcache.hand;
+      pg->prev = pcache.hand->prev;
+      pg->prev->next = pg;
+      pcache.hand->prev = pg;
+    }
+    pcache.npages++;
+    pg->data = data;
+  } else if((pg = pcvictim()) != 0){
+    pcforget(pg);
+  } else {
+    release(&pcache.lock);
+    return 0;
+  }
+
+  pg->dev = dev;
+  pg->inum = inum;
+  pg->pgno = pgno;
+  pg->valid = 0;
+  pg->ref = 1;
+  pg->referenced = 0;
+  pg->hnext = pcache.hash[pchash(dev, inum, pgno)];
+  pcache.hash[pchash(dev, inum, pgno)] = pg;
+  release(&pcache.lock);
+  return pg;
+}
+
+// Unpin a page returned by pcget().
+void
+pcput(struct page *pg)
+{
+  acquire(&pcache.lock);
+  if(pg->ref < 1)
+    panic("pcput");
+  pg->ref--;
+  release(&pcache.lock);
+}
+
+// Write-through from writei(): copy n bytes at file offset off
+// into the cached page, if there is one. Must not cross a page,
+// and src must be kernel memory since pcache.lock is held.
+// Writing back a shared mapping passes the frame itself, which
+// processes may be storing to meanwhile; it is left alone.
+void
+pcwrite(uint dev, uint inum, uint off, char *src, uint n)
+{
+  struct page *pg;
+
+  acquire(&pcache.lock);
+  pg = pclookup(dev, inum, off / PGSIZE);
+  if(pg && pg->valid && src != pg->data + off % PGSIZE)
+    memmove(pg->data + off % PGSIZE, src, n);
+  release(&pcache.lock);
+}
+
+// Return pg's frame with a reference for the caller, who maps
+// it into a process. pg must be pinned and valid.
+char*
+pcshare(struct page *pg)
+{
+  acquire(&pcache.lock);
+  if(pg->ref < 1 || !pg->valid)
+    panic("pcshare");
+  kincref(pg->data);
+  release(&pcache.lock);
+  return pg->data;
+}
+
+// A process dropped a mapping of page pgno of the file that it
+// had stored to. The page stays until pcclean().
+void
+pcdirty(uint dev, uint inum, uint pgno)
+{
+  struct page *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pclookup(dev, inum, pgno)) != 0)
+    pg->dirty = 1;
+  release(&pcache.lock);
+}
+
+// If page pgno of the file is dirty, mark it clean and return
+// its frame with a reference for the caller, who writes it back
+// and then kfree()s it. Otherwise return 0.
+char*
+pcclean(uint dev, uint inum, uint pgno)
+{
+  struct page *pg;
+  char *mem;
+
+  mem = 0;
+  acquire(&pcache.lock);
+  if((pg = pclookup(dev, inum, pgno)) != 0 && pg->dirty){
+    pg->dirty = 0;
+    kincref(pg->data);
+    mem = pg->data;
+  }
+  release(&pcache.lock);
+  return mem;
+}
+
+// Drop the first npages pages of a file that is being truncated.
+void
+pcinval(uint dev, uint inum, uint npages)
+{
+  struct page *pg;
+  uint pgno;
+
+  acquire(&pcache.lock);
+  for(pgno = 0; pgno < npages; pgno++){
+    if((pg = pclookup(dev, inum, pgno)) == 0)
+      continue;
+    if(pg->ref > 0)
+      panic("pcinval: page in use");
+    pcforget(pg);
+  }
+  release(&pcache.lock);
+}
+
+// Give up the frame of an unpinned page, chosen by the clock
+// hand. Called by kalloc() when memory runs out. Returns 0 if
+// no page can give up its frame.
+int
+pcreclaim(void)
+{
+  struct page *pg;
+  char *data;
+
+  // kalloc() from within the cache must not wait for itself.
+  if(holding(&pcache.lock))
+    return 0;
+  acquire(&pcache.lock);
+  if((pg = pcvictim()) == 0){
+    release(&pcache.lock);
+    return 0;
+  }
+  pcforget(pg);
+  if(pg->next == pg)
+    pcache.hand = 0;
+  else {
+    pg->prev->next = pg->next;
+    pg->next->prev = pg->prev;
+    if(pcache.hand == pg)
+      pcache.hand = pg->next;
+  }
+  pcache.npages--;
+  data = pg->data;
+  pg->data = 0;
+  pg->prev = 0;
+  pg->next = pcache.free;
+  pcache.free = pg;
+  release(&pcache.lock);
+
+  kfree(data);
+  return 1;
+}
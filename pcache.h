@@ -0,0 +1,13 @@
+struct page {
+  uint dev;
+  uint inum;
+  uint pgno;          // page number within the file
+  char *data;         // PGSIZE bytes of file content
+  int valid;          // data has been read from the file?
+  int dirty;          // stored to through a shared mapping, not written back
+  int ref;            // pinned by readers while non-zero
+  int referenced;     // looked up since the clock hand passed
+  struct page *hnext; // hash chain
+  struct page *next;  // ring of pages holding a frame, or free list
+  struct page *prev;
+};
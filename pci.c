@@ -0,0 +1,79 @@
+// PCI configuration space access (configuration mechanism #1)
+// and a scan of the buses for a device to drive.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define NPCIBUS 4    // buses scanned; QEMU puts everything on bus 0
+
+static uint
+pciaddr(struct pcidev *d, int reg)
+{
+  return 0x80000000 | (d->bus << 16) | (d->dev << 11) | (d->func << 8) | (reg & 0xFC);
+}
+
+uint
+pciread(struct pcidev *d, int reg)
+{
+  outl(PCI_CONFIG_ADDR, pciaddr(d, reg));
+  return inl(PCI_CONFIG_DATA);
+}
+
+void
+pciwrite(struct pcidev *d, int reg, uint v)
+{
+  outl(PCI_CONFIG_ADDR, pciaddr(d, reg));
+  outl(PCI_CONFIG_DATA, v);
+}
+
+// Find the first function that matches vendor, device, class and
+// subclass, each of which may be PCI_ANY, and fill in *d.
+// Returns 0, or -1 if there is none.
+int
+pcifind(int vendor, int device, int class, int subclass, struct pcidev *d)
+{
+  uint id, cl;
+
+  for(d->bus = 0; d->bus < NPCIBUS; d->bus++){
+    for(d->dev = 0; d->dev < 32; d->dev++){
+      for(d->func = 0; d->func < 8; d->func++){
+        id = pciread(d, PCI_ID);
+        if((id & 0xFFFF) == 0xFFFF)
+          continue;
+        cl = pciread(d, PCI_CLASS);
+        d->vendor = id & 0xFFFF;
+        d->device = id >> 16;
+        d->class = cl >> 24;
+        d->subclass = (cl >> 16) & 0xFF;
+        d->progif = (cl >> 8) & 0xFF;
+        d->irq = pciread(d, PCI_INTR) & 0xFF;
+        if((vendor == PCI_ANY || vendor == d->vendor) &&
+           (device == PCI_ANY || device == d->device) &&
+           (class == PCI_ANY || class == d->class) &&
+           (subclass == PCI_ANY || subclass == d->subclass))
+          return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+// Return base address register n of d, without the type bits.
+uint
+pcibar(struct pcidev *d, int n)
+{
+  uint bar = pciread(d, PCI_BAR0 + 4*n);
+
+  if(bar & 1)
+    return bar & ~3;     // I/O space
+  return bar & ~0xF;     // memory space
+}
+
+// Set bits in d's command register, e.g. PCI_CMD_MASTER.
+void
+pcienable(struct pcidev *d, int bits)
+{
+  pciwrite(d, PCI_COMMAND, (pciread(d, PCI_COMMAND) & 0xFFFF) | bits);
+}
@@ -0,0 +1,33 @@
+// PCI configuration space.
+
+#define PCI_CONFIG_ADDR  0xCF8
+#define PCI_CONFIG_DATA  0xCFC
+
+// Configuration registers (byte offsets)
+#define PCI_ID           0x00  // vendor (low), device (high)
+#define PCI_COMMAND      0x04  // command (low), status (high)
+#define PCI_CLASS        0x08  // revision, prog-if, subclass, class
+#define PCI_BAR0         0x10
+#define PCI_INTR         0x3C  // interrupt line (low byte)
+
+// Command register bits
+#define PCI_CMD_IO       0x0001  // respond to I/O space accesses
+#define PCI_CMD_MEM      0x0002  // respond to memory space accesses
+#define PCI_CMD_MASTER   0x0004  // may act as bus master
+
+#define PCI_CLASS_STORAGE  0x01
+#define PCI_SUBCLASS_IDE   0x01
+
+#define PCI_ANY          -1
+
+struct pcidev {
+  int bus;
+  int dev;
+  int func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar progif;
+  uchar irq;          // interrupt line set up by the BIOS
+};
@@ -8,17 +8,28 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// The buffer is a ring of whole pages. It starts at one page and
+// grows, up to PIPEMAXPAGES, whenever a writer finds it full.
+// Data moves with memmove() in the largest contiguous span.
+// The size need not be a power of two, so the counters are not
+// left to wrap: the reader keeps nread below the size.
+#define PIPEMAXPAGES 8
+#define PIPESIZE(p) ((p)->npages * PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
-  uint nread;     // number of bytes read
-  uint nwrite;    // number of bytes written
+  char *pages[PIPEMAXPAGES];
+  uint npages;
+  uint nread;     // number of bytes read, modulo the size
+  uint nwrite;    // nread plus the bytes in the pipe
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int readwaiting;   // a reader sleeps on an empty pipe
+  int writewaiting;  // a writer sleeps on a full pipe
 };
 
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,6 +41,10 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(p, 0, sizeof(*p));
+  if((p->pages[0] = kalloc()) == 0)
+    goto bad;
+  p->npages = 1;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -47,8 +62,11 @@ pipealloc(struct file **f0, struct file **f1)
 
 //PAGEBREAK: 20
  bad:
-  if(p)
+  if(p){
+    if(p->pages[0])
+      kfree(p->pages[0]);
     kfree((char*)p);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -59,6 +77,8 @@ pipealloc(struct file **f0, struct file **f1)
 void
 pipeclose(struct pipe *p, int writable)
 {
+  int i;
+
   acquire(&p->lock);
   if(writable){
     p->writeopen = 0;
@@ -69,53 +89,140 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
+    for(i = 0; i < p->npages; i++)
+      kfree(p->pages[i]);
     kfree((char*)p);
   } else
     release(&p->lock);
 }
 
+// Add a page to a full pipe. Returns -1 if it is as large as
+// it may get or memory is short. Caller must hold p->lock.
+//
+// The data runs from offset r = nread % size around to r again.
+// Say r lies in page k at offset o. The new page goes in front
+// of page k and receives page k's first o bytes, which are the
+// tail of the data; the free space is then the rest of the new
+// page plus those (now stale) o bytes of page k.
+static int
+pipegrow(struct pipe *p)
+{
+  uint r, k, o, size;
+  char *mem;
+  int i;
+
+  if(p->npages == PIPEMAXPAGES || (mem = kalloc()) == 0)
+    return -1;
+  size = PIPESIZE(p);
+  r = p->nread % size;
+  k = r / PGSIZE;
+  o = r % PGSIZE;
+  for(i = p->npages; i > k; i--)
+    p->pages[i] = p->pages[i-1];
+  p->pages[k] = mem;
+  p->npages++;
+  memmove(mem, p->pages[k+1], o);
+  p->nread = (k+1)*PGSIZE + o;
+  p->nwrite = p->nread + size;
+  return 0;
+}
+
 //PAGEBREAK: 40
+// User memory may have to be paged in, which sleeps, so it is
+// never touched with p->lock held: data moves between it and the
+// pipe through a kernel page, a page at a time.
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, j, k, m;
+  uint off;
+  char *buf;
 
+  if((buf = kalloc()) == 0)
+    return -1;
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(p->readopen == 0 || myproc()->killed){
-        release(&p->lock);
-        return -1;
+  for(i = 0; i < n; i += j){
+    j = min(n - i, PGSIZE);
+    release(&p->lock);
+    memmove(buf, addr + i, j);
+    acquire(&p->lock);
+    for(k = 0; k < j; k += m){
+      while(p->nwrite == p->nread + PIPESIZE(p)){  //DOC: pipewrite-full
+        if(p->readopen == 0 || myproc()->killed){
+          release(&p->lock);
+          kfree(buf);
+          return -1;
+        }
+        if(pipegrow(p) == 0)
+          break;
+        if(p->readwaiting){
+          p->readwaiting = 0;
+          wakeup(&p->nread);
+        }
+        p->writewaiting = 1;
+        idlesleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
       }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      off = p->nwrite % PIPESIZE(p);
+      m = min(j - k, PIPESIZE(p) - (p->nwrite - p->nread));
+      m = min(m, PGSIZE - off % PGSIZE);
+      memmove(p->pages[off / PGSIZE] + off % PGSIZE, buf + k, m);
+      p->nwrite += m;
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+  if(p->readwaiting){  //DOC: pipewrite-wakeup1
+    p->readwaiting = 0;
+    wakeup(&p->nread);
+  }
   release(&p->lock);
+  kfree(buf);
   return n;
 }
 
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, j, m;
+  uint off;
+  char *buf;
 
+  if((buf = kalloc()) == 0)
+    return -1;
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
     if(myproc()->killed){
       release(&p->lock);
+      kfree(buf);
       return -1;
     }
-    sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+    p->readwaiting = 1;
+    idlesleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
+  for(i = 0; i < n; i += j){  //DOC: piperead-copy
+    for(j = 0; j < n - i && j < PGSIZE && p->nread != p->nwrite; j += m){
+      off = p->nread % PIPESIZE(p);
+      m = min(n - i - j, PGSIZE - j);
+      m = min(m, p->nwrite - p->nread);
+      m = min(m, PGSIZE - off % PGSIZE);
+      memmove(buf + j, p->pages[off / PGSIZE] + off % PGSIZE, m);
+      p->nread += m;
+      if(p->nread >= PIPESIZE(p)){
+        p->nread -= PIPESIZE(p);
+        p->nwrite -= PIPESIZE(p);
+      }
+    }
+    if(j == 0)
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    // Let a blocked writer go only once half the buffer is free,
+    // so that it refills it in large chunks.
+    if(p->writewaiting && p->nwrite - p->nread <= PIPESIZE(p) / 2){  //DOC: piperead-wakeup
+      p->writewaiting = 0;
+      wakeup(&p->nwrite);
+    }
+    release(&p->lock);
+    memmove(addr + i, buf, j);
+    acquire(&p->lock);
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
+  kfree(buf);
   return i;
 }
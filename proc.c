@@ -12,6 +12,48 @@ struct {
   struct proc proc[NPROC];
 } ptable;
 
+// Per-CPU run queues. A RUNNABLE process is on exactly one
+// of them, normally that of the CPU it last ran on, and comes
+// off it only in scheduler(). A CPU with an empty queue steals
+// from the CPU with the longest one. Queues have their own
+// locks, so that choosing the next process does not take
+// ptable.lock; changing p->state still needs ptable.lock, and
+// is followed by queueing when the new state is RUNNABLE.
+//
+// Each queue is a multi-level feedback queue: NPRIO FIFOs, and
+// the scheduler runs the first process of the highest level
+// (0) that has one. A process at level l runs for QUANTUM(l)
+// ticks before it yields, and then drops a level; a process of
+// a higher level waiting on its CPU preempts it at the next
+// tick. A process that wakes from sleep (disk, pipe, console,
+// page-in) rises a level, so interactive and I/O-bound
+// processes stay near the top. Every BOOSTTICKS ticks all
+// processes go back to level 0, so that none starves. The boost
+// is lazy: a run queue moves its lower levels to level 0, and a
+// process resets its level, the first time each is used in a
+// new boost epoch, rather than the timer walking them all.
+#define QUANTUM(prio) (1 << (prio))
+#define BOOSTEPOCH() (ticks / BOOSTTICKS)
+
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];   // one FIFO per level, through rqnext
+  struct proc *tail[NPRIO];
+  int n;                      // processes on all levels
+  uint epoch;                 // BOOSTEPOCH() at the last boost
+};
+
+static struct runq runq[NCPU];
+
+// Wait queues. A SLEEPING process is on the queue of the bucket
+// its chan hashes to, so that wakeup() looks only at processes
+// sleeping on channels of that bucket, however many processes
+// there are. Protected by ptable.lock, like p->chan.
+#define NWAITQ 61
+#define WAITQ(chan) (&waitq[((uint)(chan) >> 2) % NWAITQ])
+
+static struct proc *waitq[NWAITQ];   // chained through wqnext
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -19,9 +61,104 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void swapper(void);
+static void sleep1(void *chan, struct spinlock *lk, int idle);
 
 void pinit(void) {
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  for(i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+}
+
+// Put p back at level 0 if a boost epoch has begun since it
+// was last boosted. Caller owns p: it is not on a run queue, or
+// is running on this CPU.
+static void boost(struct proc *p) {
+  uint e = BOOSTEPOCH();
+
+  if(p->boostepoch != e){
+    p->boostepoch = e;
+    p->prio = 0;
+    p->runticks = 0;
+  }
+}
+
+// Make p RUNNABLE and put it at the tail of the run queue of
+// the CPU it last ran on. Caller holds ptable.lock.
+// The queue level is p->prio. A process whose memory the
+// swapper is moving waits for the swapper to queue it.
+static void setrunnable(struct proc *p) {
+  struct runq *rq = &runq[p->cpu];
+  int l;
+
+  boost(p);
+  l = p->prio;
+  p->state = RUNNABLE;
+  if(p->swapping)
+    return;
+  acquire(&rq->lock);
+  p->rqnext = 0;
+  if(rq->tail[l])
+    rq->tail[l]->rqnext = p;
+  else
+    rq->head[l] = p;
+  rq->tail[l] = p;
+  rq->n++;
+  release(&rq->lock);
+}
+
+static struct proc* rqpop(struct runq *rq) {
+  struct proc *p;
+  uint e = BOOSTEPOCH();
+  int l;
+
+  p = 0;
+  acquire(&rq->lock);
+  if(rq->epoch != e){
+    // Append the lower levels to level 0, in order.
+    rq->epoch = e;
+    for(l = 1; l < NPRIO; l++){
+      if(rq->head[l] == 0)
+        continue;
+      if(rq->tail[0])
+        rq->tail[0]->rqnext = rq->head[l];
+      else
+        rq->head[0] = rq->head[l];
+      rq->tail[0] = rq->tail[l];
+      rq->head[l] = rq->tail[l] = 0;
+    }
+  }
+  for(l = 0; l < NPRIO; l++){
+    if((p = rq->head[l]) != 0){
+      if((rq->head[l] = p->rqnext) == 0)
+        rq->tail[l] = 0;
+      rq->n--;
+      break;
+    }
+  }
+  release(&rq->lock);
+  if(p)
+    boost(p);
+  return p;
+}
+
+// The next process for CPU id to run: from its own queue,
+// or else from the busiest other CPU's. 0 if there is none.
+static struct proc* runqget(int id) {
+  struct proc *p;
+  int i, busiest;
+
+  if((p = rqpop(&runq[id])) != 0)
+    return p;
+  busiest = -1;
+  for(i = 0; i < ncpu; i++)
+    if(i != id && runq[i].n > 0 && (busiest < 0 || runq[i].n > runq[busiest].n))
+      busiest = i;
+  if(busiest < 0)
+    return 0;
+  return rqpop(&runq[busiest]);
 }
 
 // Must be called with interrupts disabled
@@ -80,6 +217,16 @@ static struct proc* allocproc(void) {
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->prio = 0;
+  p->runticks = 0;
+  p->boostepoch = BOOSTEPOCH();
+  p->suspended = 0;
+  p->suspPageCount = 0;
+  p->suspTableCount = 0;
+  p->idle = 0;
+  p->swapping = 0;
+  p->pgbusy = 0;
+  p->kernthread = 0;
 
   release(&ptable.lock);
 
@@ -138,9 +285,35 @@ void userinit(void) {
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  setrunnable(p);
+
+  release(&ptable.lock);
+}
+
+// Start a kernel thread that runs fn, which must never return.
+// It has no user memory; it goes through forkret like any new
+// process, but forkret returns into fn instead of trapret.
+struct proc* kthread(char *name, void (*fn)(void)) {
+  struct proc *p;
 
+  if((p = allocproc()) == 0)
+    return 0;
+  if((p->pgdir = setupkvm()) == 0){
+    kfree(p->kstack);
+    p->kstack = 0;
+    p->state = UNUSED;
+    return 0;
+  }
+  p->sz = 0;
+  p->parent = initproc;
+  p->kernthread = 1;
+  *(uint*)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  setrunnable(p);
   release(&ptable.lock);
+  return p;
 }
 
 // Grow current process's memory by n bytes.
@@ -151,6 +324,8 @@ int growproc(int n) {
 
   sz = curproc->sz;
   if(n > 0){
+    if(sz + n > MMAPBASE)
+      return -1;
     if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   } else if(n < 0){
@@ -162,10 +337,13 @@ int growproc(int n) {
   return 0;
 }
 
+// Is p subject to paging? Kernel threads, init and the shell
+// are not.
 int isUserProc(struct proc* p) {
-  if( p->pid<=2 || !p ) return 0;
+  if( !p || p->kernthread || p == initproc ) return 0;
   if( strlen(p->name)==0 ) return 0;
-  if( strncmp(p->name, "sh", 2) != 0 && strncmp(p->name, "init", 4) != 0 ) return 1;
+  if( strncmp(p->name, "sh", sizeof(p->name)) != 0 &&
+      strncmp(p->name, "init", sizeof(p->name)) != 0 ) return 1;
   else return 0;
 }
 
@@ -212,6 +390,13 @@ int fork(void) {
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  for(i = 0; i < NVMA; i++){
+    np->vmas[i] = curproc->vmas[i];
+    if(np->vmas[i].shm)
+      shmdup(np->vmas[i].shm);
+    else if(np->vmas[i].end)
+      idup(np->vmas[i].ip);
+  }
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -219,7 +404,8 @@ int fork(void) {
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  np->cpu = curproc->cpu;
+  setrunnable(np);
 
   release(&ptable.lock);
 
@@ -252,6 +438,9 @@ void exit(void) {
     }
   }
   
+  // Write back dirty shared mappings and drop their inodes.
+  munmapall(curproc);
+
   if( isUserProc(curproc) ) removeSwapFile(curproc);
 
   begin_op();
@@ -317,7 +506,7 @@ int wait(void) {
     }
 
     // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-    sleep(curproc, &ptable.lock);  //DOC: wait-sleep
+    idlesleep(curproc, &ptable.lock);  //DOC: wait-sleep
   }
 }
 
@@ -332,39 +521,40 @@ int wait(void) {
 void scheduler(void) {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = c - cpus;
   c->proc = 0;
-  int ran;     
   
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-    for(ran = 0, p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
-
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      ran = 1;     
-      c->proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
-
-      swtch(&(c->scheduler), p->context);
-      switchkvm();
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
-    }
-    release(&ptable.lock);
-
-    if( ran==0 ) {    
+    // Take a process off the run queues; sleep until the
+    // next interrupt if there is none.
+    if((p = runqget(id)) == 0){
       halt();
+      continue;
     }
+
+    // Switch to chosen process.  It is the process's job
+    // to release ptable.lock and then reacquire it
+    // before jumping back to us. Holding ptable.lock
+    // also waits for the CPU p last ran on to finish
+    // saving its context.
+    acquire(&ptable.lock);
+    c->proc = p;
+    p->cpu = id;
+    p->lastrun = ticks;
+    switchuvm(p);
+    p->state = RUNNING;
+
+    swtch(&(c->scheduler), p->context);
+    switchkvm();
+
+    // Process is done running for now. It may not be p, but the
+    // last of those sched() switched to directly from p.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&ptable.lock);
   }
 }
 
@@ -375,9 +565,18 @@ void scheduler(void) {
 // be proc->intena and proc->ncli, but that would
 // break in the few places where a lock is held but
 // there's no process.
+//
+// If this CPU's run queue has a process, switch straight
+// to it instead, with ptable.lock passed on as scheduler()
+// would: one page table load and a new esp0 in the TSS,
+// rather than going through the kernel page table and a
+// full switchuvm(). A process that yields and is still the
+// best choice just keeps running.
 void sched(void) {
   int intena;
   struct proc *p = myproc();
+  struct cpu *c = mycpu();
+  struct proc *np;
 
   if(!holding(&ptable.lock))
     panic("sched ptable.lock");
@@ -387,19 +586,186 @@ void sched(void) {
     panic("sched running");
   if(readeflags()&FL_IF)
     panic("sched interruptible");
-  intena = mycpu()->intena;
-  swtch(&p->context, mycpu()->scheduler);
+  intena = c->intena;
+  np = rqpop(&runq[c - cpus]);
+  if(np == p)
+    p->state = RUNNING;
+  else if(np){
+    c->proc = np;
+    np->cpu = c - cpus;
+    np->lastrun = ticks;
+    switchuvmfast(np);
+    np->state = RUNNING;
+    swtch(&p->context, np->context);
+  } else
+    swtch(&p->context, c->scheduler);
   mycpu()->intena = intena;
 }
 
+// Account a timer tick to the running process. Returns 1 if
+// it should yield: its quantum is used up, so it also drops a
+// level, or a process of a higher level is waiting.
+int schedtick(void) {
+  struct proc *p = myproc();
+  struct runq *rq;
+  int l;
+
+  boost(p);
+  if(++p->runticks >= QUANTUM(p->prio)){
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    p->runticks = 0;
+    return 1;
+  }
+  rq = &runq[p->cpu];
+  for(l = 0; l < p->prio; l++)
+    if(rq->head[l])
+      return 1;
+  return 0;
+}
+
 // Give up the CPU for one scheduling round.
 void yield(void) {
   acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  setrunnable(myproc());
   sched();
   release(&ptable.lock);
 }
 
+// Load control.
+//
+// When the disk never rests and page faults keep coming, every
+// process is waiting for its own pages and throughput collapses.
+// The swapper, a kernel thread, then suspends processes one at a
+// time: a suspended process stops on its way back to user space,
+// moves its whole resident set to its swap file (suspendOut in
+// vm.c) and waits, so the remaining processes have the disk and
+// memory to themselves. Once the fault rate is down again, the
+// process suspended longest comes back, and one that has been out
+// for SUSPENDMAX ticks comes back anyway, so that none starves.
+// At least one user process always stays active.
+//
+// The swapper also takes the memory of processes that have been
+// asleep in idlesleep() for IDLETICKS ticks, e.g. waiting for a
+// child or a timer, and gives it to the active ones; the process
+// reads it back when it wakes (see sleep1).
+
+// Called on the way back to user space by a process the swapper
+// suspended: swap out, wait to be resumed, swap back in. Should
+// memory be short by then, stay suspended until the swapper
+// resumes it again. A killed process need not come back in.
+void suspend(void) {
+  struct proc *p = myproc();
+
+  suspendOut(p);
+  acquire(&ptable.lock);
+  for(;;){
+    while(p->suspended && !p->killed)
+      sleep(&p->suspended, &ptable.lock);
+    p->suspended = 0;
+    release(&ptable.lock);
+    if(p->killed || suspendIn(p) == 0)
+      return;
+    acquire(&ptable.lock);
+    p->suspended = 1;
+    p->suspendtick = ticks;
+  }
+}
+
+// Pick the process cheapest to suspend: the one with the most
+// resident pages, then the one that has waited longest for the
+// CPU. Caller holds ptable.lock.
+static struct proc* suspendvictim(void) {
+  struct proc *p, *victim = 0;
+  int nactive = 0;
+
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->suspended || p->swapFile == 0 || p->killed || !isUserProc(p))
+      continue;
+    if(p->state != RUNNABLE && p->state != RUNNING && p->state != SLEEPING)
+      continue;
+    nactive++;
+    if(victim == 0 || p->memPageCount > victim->memPageCount ||
+       (p->memPageCount == victim->memPageCount && p->lastrun < victim->lastrun))
+      victim = p;
+  }
+  return nactive > 1 ? victim : 0;
+}
+
+// Resume the process suspended longest, if it has been out
+// for at least min ticks. Caller holds ptable.lock.
+static void resumeone(uint min) {
+  struct proc *p, *oldest = 0;
+
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->suspended && (oldest == 0 || p->suspendtick < oldest->suspendtick))
+      oldest = p;
+  if(oldest && ticks - oldest->suspendtick >= min){
+    oldest->suspended = 0;
+    wakeup1(&oldest->suspended);
+  }
+}
+
+// Find a process long asleep in idlesleep() whose memory is
+// still in. Caller holds ptable.lock.
+static struct proc* idlevictim(void) {
+  struct proc *p;
+
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state != SLEEPING || !p->idle || p->swapping || p->swapFile == 0)
+      continue;
+    if(p->memPageCount == 0 || p->suspPageCount > 0 || p->suspTableCount > 0)
+      continue;
+    if(ticks - p->sleeptick >= IDLETICKS && isUserProc(p))
+      return p;
+  }
+  return 0;
+}
+
+static void swapper(void) {
+  struct proc *p;
+  uint faults, busy, t, i;
+
+  for(;;){
+    // Sample the disk on every tick of the window.
+    faults = nfaults;
+    busy = 0;
+    for(i = 0; i < SWAPWINDOW; i++){
+      acquire(&tickslock);
+      t = ticks;
+      while(ticks == t)
+        sleep(&ticks, &tickslock);
+      release(&tickslock);
+      if(idebusy())
+        busy++;
+    }
+    faults = nfaults - faults;
+
+    acquire(&ptable.lock);
+    if(faults >= THRASHFAULTS && busy >= SWAPWINDOW*3/4){
+      if((p = suspendvictim()) != 0){
+        p->suspended = 1;
+        p->suspendtick = ticks;
+      }
+    } else if(faults < THRASHFAULTS/4 || busy < SWAPWINDOW/2)
+      resumeone(0);
+    resumeone(SUSPENDMAX);
+
+    // Swap out idle processes. Should one wake meanwhile,
+    // setrunnable() leaves it to us to queue it.
+    while((p = idlevictim()) != 0){
+      p->swapping = 1;
+      release(&ptable.lock);
+      suspendOut(p);
+      acquire(&ptable.lock);
+      p->swapping = 0;
+      if(p->state == RUNNABLE)
+        setrunnable(p);
+    }
+    release(&ptable.lock);
+  }
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch here.  "Return" to user space.
 void forkret(void) {
@@ -414,6 +780,8 @@ void forkret(void) {
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    if(kthread("swapper", swapper) == 0)
+      panic("swapper");
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -422,7 +790,21 @@ void forkret(void) {
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void sleep(void *chan, struct spinlock *lk) {
+  sleep1(chan, lk, 0);
+}
+
+// Like sleep(), for waits that may last long: for a child, a
+// timer, a pipe or the console. The caller holds no lock but lk,
+// no sleep-lock and no transaction, so the swapper may swap the
+// whole process out meanwhile (see swapper); it is swapped back
+// in here, before lk is reacquired.
+void idlesleep(void *chan, struct spinlock *lk) {
+  sleep1(chan, lk, 1);
+}
+
+static void sleep1(void *chan, struct spinlock *lk, int idle) {
   struct proc *p = myproc();
+  int r;
   
   if(p == 0)
     panic("sleep");
@@ -443,11 +825,31 @@ void sleep(void *chan, struct spinlock *lk) {
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->wqnext = *WAITQ(chan);
+  *WAITQ(chan) = p;
+  p->idle = idle;
+  p->sleeptick = ticks;
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  p->idle = 0;
+
+  // Should memory be short, wait as a suspended process
+  // does for the swapper to let us try again.
+  while(idle && (p->suspPageCount > 0 || p->suspTableCount > 0) && !p->killed){
+    release(&ptable.lock);
+    r = suspendIn(p);
+    acquire(&ptable.lock);
+    if(r == 0)
+      break;
+    p->suspended = 1;
+    p->suspendtick = ticks;
+    while(p->suspended && !p->killed)
+      sleep(&p->suspended, &ptable.lock);
+    p->suspended = 0;
+  }
 
   // Reacquire original lock.
   if(lk != &ptable.lock){  //DOC: sleeplock2
@@ -460,11 +862,34 @@ void sleep(void *chan, struct spinlock *lk) {
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
 static void wakeup1(void *chan) {
-  struct proc *p;
+  struct proc *p, **pp;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  for(pp = WAITQ(chan); (p = *pp) != 0; ){
+    if(p->chan != chan){
+      pp = &p->wqnext;
+      continue;
+    }
+    *pp = p->wqnext;
+    // Waking from a wait rises a level.
+    if(p->prio > 0)
+      p->prio--;
+    p->runticks = 0;
+    setrunnable(p);
+  }
+}
+
+// Take sleeping p off its wait queue, to wake it for
+// another reason than its chan. Caller holds ptable.lock.
+static void wqremove(struct proc *p) {
+  struct proc **pp;
+
+  for(pp = WAITQ(p->chan); *pp; pp = &(*pp)->wqnext){
+    if(*pp == p){
+      *pp = p->wqnext;
+      return;
+    }
+  }
+  panic("wqremove");
 }
 
 // Wake up all processes sleeping on chan.
@@ -485,8 +910,10 @@ int kill(int pid) {
     if(p->pid == pid){
       p->killed = 1;
       // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
+      if(p->state == SLEEPING){
+        wqremove(p);
+        setrunnable(p);
+      }
       release(&ptable.lock);
       return 0;
     }
@@ -548,7 +975,7 @@ void procdump(void) {
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
+    cprintf("%d %s %s%s", p->pid, state, p->name, p->suspended ? " suspended" : "");
     if(p->state == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
@@ -565,8 +992,11 @@ void clockInterruptUpdate() {
   uint pageAddress, pgdir_entry, pgtable_PPN, pgtable_index;
   uint *pgtable_base, *pgtable_entry;
 
+  // ptable.lock keeps suspendOut()/suspendIn() from starting
+  // on a process while its page tables are walked here.
+  acquire(&ptable.lock);
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if( p->state!=UNUSED && p->state!=ZOMBIE && isUserProc(p) ) {
+    if( p->state!=UNUSED && p->state!=ZOMBIE && isUserProc(p) && !p->pgbusy ) {
       for( int i=0; i<p->memPageCount; i++ ) {
         pageAddress = p->pagesFIFO[i];
         pgdir_entry = p->pgdir[ PDX(pageAddress) ];
@@ -585,6 +1015,15 @@ void clockInterruptUpdate() {
       }
     }
   }
+  release(&ptable.lock);
+}
+
+// Mark p's page tables as being rebuilt, or done, so that
+// clockInterruptUpdate() leaves them alone.
+void setpgbusy(struct proc *p, int busy) {
+  acquire(&ptable.lock);
+  p->pgbusy = busy;
+  release(&ptable.lock);
 }
 
 struct proc* getProcFromPgdir(pde_t *pgdir) {
@@ -40,6 +40,23 @@ struct context {
   uint eip;
 };
 
+// A file-backed or shared region of the address space. Either a
+// file mapping created by mmap() above MMAPBASE, or a program
+// segment that exec() maps below sz, whose pages start out as
+// non-present PTE_MM entries and are read from ip on first touch
+// (see mmapIn in vm.c); or an attached shared memory segment
+// (shm != 0).
+struct vma {
+  uint start;                  // First address (page aligned)
+  uint end;                    // One past the last address (page aligned), 0 if unused
+  uint off;                    // File offset that start maps
+  uint filesz;                 // Bytes of the file mapped; the rest reads as zero
+  int prot;                    // PROT_READ / PROT_WRITE
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct inode *ip;            // Backing file
+  struct shmseg *shm;          // Attached segment, or 0
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -53,6 +70,7 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *wqnext;         // Wait queue link, while SLEEPING
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
@@ -65,6 +83,23 @@ struct proc {
   uint pagesFIFO[MAX_PSYC_PAGES];
   uint pagesAge[MAX_PSYC_PAGES];
   uint verbose;
+  struct vma vmas[NVMA];        // mmap() regions
+  int cpu;                     // CPU it last ran on, whose run queue it joins
+  int prio;                    // Scheduling level, 0 highest
+  int runticks;                // Ticks run at this level
+  uint boostepoch;             // BOOSTEPOCH() when prio was last reset
+  struct proc *rqnext;         // Run queue link, while RUNNABLE
+  uint lastrun;                // Tick it was last scheduled
+  int suspended;               // Swapper wants it off the CPU and out of memory
+  uint suspendtick;            // Tick suspended was set
+  uint suspMap[MAX_PSYC_PAGES]; // Pages moved out by suspendOut(), see vm.c
+  uint suspPageCount;
+  uint suspTableCount;         // Page tables moved out with them
+  int idle;                    // In idlesleep(): its memory may be swapped out
+  uint sleeptick;              // Tick it went to sleep
+  int swapping;                // The swapper is moving its memory; keep off the run queues
+  int pgbusy;                  // suspendOut()/suspendIn() rebuilding its page tables
+  int kernthread;              // Kernel thread (see kthread): no user memory to page
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,147 @@
+// Shared memory segments.
+//
+// shmget() finds or creates the segment with a given key,
+// shmat() maps it into the calling process above MMAPBASE and
+// shmdt() removes that mapping again. All attached processes
+// use the same physical frames (see mapsegment in vm.c), so
+// data written by one is seen by the others without copying.
+//
+// The segment holds one reference to each of its frames and
+// every mapping holds another. A segment is destroyed when its
+// last attachment goes away; one that was created but never
+// attached stays around until it is.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "shm.h"
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shm");
+}
+
+// Return the id of the segment with key, creating it with
+// room for size bytes if there is none. Returns -1 if the
+// key is invalid, an existing segment is too small, or
+// there is no memory.
+int
+shmget(int key, uint size)
+{
+  struct shmseg *s, *empty;
+  int i, npages;
+
+  npages = PGROUNDUP(size) / PGSIZE;
+  if(key == 0 || npages == 0 || npages > SHMMAXPAGES)
+    return -1;
+
+  acquire(&shmtable.lock);
+  empty = 0;
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++){
+    if(s->key == key){
+      release(&shmtable.lock);
+      return s->npages >= npages ? s - shmtable.seg : -1;
+    }
+    if(empty == 0 && s->key == 0)
+      empty = s;
+  }
+  if(empty == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+
+  s = empty;
+  for(i = 0; i < npages; i++){
+    if((s->pages[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(s->pages[i]);
+      release(&shmtable.lock);
+      return -1;
+    }
+    memset(s->pages[i], 0, PGSIZE);
+  }
+  s->key = key;
+  s->npages = npages;
+  s->nattach = 0;
+  release(&shmtable.lock);
+  return s - shmtable.seg;
+}
+
+// Map segment id into the current process.
+// Returns the address, or -1.
+int
+shmat(int id)
+{
+  struct shmseg *s;
+  int va;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shmtable.seg[id];
+
+  acquire(&shmtable.lock);
+  if(s->key == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  s->nattach++;
+  release(&shmtable.lock);
+
+  if((va = mapsegment(myproc(), s)) < 0)
+    shmrelease(s);
+  return va;
+}
+
+// Unmap the segment attached at addr from the current process.
+int
+shmdt(uint addr)
+{
+  struct proc *p = myproc();
+  struct shmseg *s;
+  struct vma *v;
+
+  if((v = findvma(p, addr)) == 0 || v->shm == 0 || v->start != addr)
+    return -1;
+  s = v->shm;
+  unmapsegment(p, v);
+  shmrelease(s);
+  return 0;
+}
+
+// fork() copied a mapping of s.
+void
+shmdup(struct shmseg *s)
+{
+  acquire(&shmtable.lock);
+  s->nattach++;
+  release(&shmtable.lock);
+}
+
+// Drop one attachment of s, destroying it if that was the last.
+void
+shmrelease(struct shmseg *s)
+{
+  int i;
+
+  acquire(&shmtable.lock);
+  if(s->nattach < 1)
+    panic("shmrelease");
+  if(--s->nattach == 0){
+    for(i = 0; i < s->npages; i++){
+      kfree(s->pages[i]);
+      s->pages[i] = 0;
+    }
+    s->key = 0;
+    s->npages = 0;
+  }
+  release(&shmtable.lock);
+}
@@ -0,0 +1,6 @@
+struct shmseg {
+  int key;                     // Non-zero while the segment exists
+  int npages;
+  int nattach;                 // Address spaces it is mapped into
+  char *pages[SHMMAXPAGES];
+};
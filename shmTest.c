@@ -0,0 +1,38 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define KEY 42
+#define PAGES 4
+
+int main(int argc, char * argv[]) {
+    int id, *shared, success = 1;
+
+    id = shmget(KEY, PAGES*4096);
+    shared = (int*) shmat(id);
+    if( id<0 || shared==(int*)-1 ) {
+        printf(1, "shmget/shmat Failed\n");
+        exit();
+    }
+
+    // The child inherits the mapping and also attaches the
+    // segment a second time by key; both views share frames.
+    if( fork()==0 ) {
+        int *again = (int*) shmat(shmget(KEY, PAGES*4096));
+        for( int i=0; i<PAGES*1024; i++ ) {
+            if( i%2 ) shared[i] = i;
+            else again[i] = i;
+        }
+        shmdt(again);
+        exit();
+    }
+    wait();
+
+    for( int i=0; i<PAGES*1024; i++ ) {
+        if( shared[i] != i ) success = 0;
+    }
+    printf(1, "Shared Memory Test %s\n", success ? "Successful" : "Failed");
+
+    shmdt(shared);
+    exit();
+}
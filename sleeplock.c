@@ -17,17 +17,29 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->stat = lockstatsfor(name, 1);
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint64 wait;
+  uint pcs[10];
+
+  wait = 0;
   acquire(&lk->lk);
-  while (lk->locked) {
-    sleep(lk, &lk->lk);
+  if (lk->locked) {
+    wait = rdtsc();
+    while (lk->locked) {
+      sleep(lk, &lk->lk);
+    }
+    wait = rdtsc() - wait;
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  getcallerpcs(&lk, pcs);
+  lockacquired(lk->stat, wait, pcs[0]);
+  lk->tacquire = rdtsc();
   release(&lk->lk);
 }
 
@@ -35,6 +47,7 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  lockreleased(lk->stat, rdtsc() - lk->tacquire);
   lk->locked = 0;
   lk->pid = 0;
   wakeup(lk);
@@ -6,5 +6,7 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+  struct lockstats *stat; // Profile of the locks of this name
+  uint64 tacquire;   // rdtsc when acquired
 };
 
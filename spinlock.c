@@ -8,13 +8,122 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "lockstat.h"
+
+// Lock profile by lock name. Every acquisition counts, with the
+// rdtsc cycles spent waiting for the lock and then holding it;
+// a contended acquisition also counts for its call site, and
+// the NLOCKSITE sites that waited most are kept. Sleep-locks
+// (sleeplock.c) are profiled the same way, under their own
+// names. Each CPU has counters of its own, updated with
+// interrupts off, so counting needs no atomic operations;
+// getlockstat() adds them up.
+struct lockstats {
+  char *name;
+  int sleep;         // names sleep-locks
+  struct {
+    uint nacquire;
+    uint ncontend;
+    uint64 wait;     // cycles
+    uint64 hold;
+    struct {
+      uint pc;       // 0 if unused
+      uint n;
+      uint64 wait;
+    } site[NLOCKSITE];
+  } cpu[NCPU];
+};
+
+static struct {
+  uint busy;         // guards n; taken with xchg, as a spinlock can't be
+  int n;
+  struct lockstats stat[NLOCKSTAT];
+} lockstats;
+
+// The profile entry for locks named name, or 0 if the
+// table is full.
+struct lockstats*
+lockstatsfor(char *name, int sleep)
+{
+  struct lockstats *s;
+  int eflags;
+
+  // Not pushcli(): early locks are set up before mycpu() works.
+  eflags = readeflags();
+  cli();
+  while(xchg(&lockstats.busy, 1) != 0)
+    ;
+  for(s = lockstats.stat; s < lockstats.stat + lockstats.n; s++)
+    if(s->sleep == sleep && strncmp(s->name, name, sizeof(((struct lockstat*)0)->name)) == 0)
+      goto found;
+  s = 0;
+  if(lockstats.n < NLOCKSTAT){
+    s = &lockstats.stat[lockstats.n];
+    s->name = name;
+    s->sleep = sleep;
+    __sync_synchronize();   // entry before count
+    lockstats.n++;
+  }
+found:
+  xchg(&lockstats.busy, 0);
+  if(eflags & FL_IF)
+    sti();
+  return s;
+}
+
+// Count an acquisition from pc that waited wait cycles
+// (0 if the lock was free). Interrupts must be off.
+void
+lockacquired(struct lockstats *s, uint64 wait, uint pc)
+{
+  int c, i, min;
+
+  if(s == 0)
+    return;
+  c = mycpu() - cpus;
+  s->cpu[c].nacquire++;
+  if(wait == 0)
+    return;
+  s->cpu[c].ncontend++;
+  s->cpu[c].wait += wait;
+
+  // Keep the sites that waited most: a new one replaces
+  // the one with the least waiting so far.
+  min = 0;
+  for(i = 0; i < NLOCKSITE; i++){
+    if(s->cpu[c].site[i].pc == pc)
+      break;
+    if(s->cpu[c].site[i].wait < s->cpu[c].site[min].wait)
+      min = i;
+  }
+  if(i == NLOCKSITE){
+    i = min;
+    s->cpu[c].site[i].pc = pc;
+    s->cpu[c].site[i].n = 0;
+    s->cpu[c].site[i].wait = 0;
+  }
+  s->cpu[c].site[i].n++;
+  s->cpu[c].site[i].wait += wait;
+}
+
+// Count hold cycles of a lock being released.
+// Interrupts must be off.
+void
+lockreleased(struct lockstats *s, uint64 hold)
+{
+  if(s)
+    s->cpu[mycpu() - cpus].hold += hold;
+}
 
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
+  lk->next = 0;
+  lk->serving = 0;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->stat = lockstatsfor(name, 0);
 }
 
 // Acquire the lock.
@@ -24,13 +133,22 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket;
+  uint64 wait;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  // The xadd is atomic: every CPU gets a ticket of its own.
+  ticket = xadd(&lk->next, 1);
+  wait = 0;
+  if(*(volatile uint*)&lk->serving != ticket){
+    wait = rdtsc();
+    while(*(volatile uint*)&lk->serving != ticket)
+      ;
+    wait = rdtsc() - wait;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -38,8 +156,12 @@ acquire(struct spinlock *lk)
   __sync_synchronize();
 
   // Record info about lock acquisition for debugging.
+  lk->locked = 1;
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+
+  lockacquired(lk->stat, wait, lk->pcs[0]);
+  lk->tacquire = rdtsc();
 }
 
 // Release the lock.
@@ -49,8 +171,10 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  lockreleased(lk->stat, rdtsc() - lk->tacquire);
   lk->pcs[0] = 0;
   lk->cpu = 0;
+  lk->locked = 0;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that all the stores in the critical
@@ -59,14 +183,68 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code can't use a C assignment, since it might
-  // not be atomic. A real OS would use C atomics here.
-  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  // Serve the next ticket, equivalent to lk->serving++. Only
+  // the holder writes serving, but this code can't use a C
+  // assignment, since it might not be a single store. A real
+  // OS would use C atomics here.
+  asm volatile("movl %1, %0" : "+m" (lk->serving) : "r" (lk->serving + 1));
 
   popcli();
 }
 
+// Copy the profiles of up to n lock names to st, summed over
+// the CPUs. Returns the number of entries copied.
+int
+getlockstat(struct lockstat *st, int n)
+{
+  struct lockstats *s;
+  struct lockstat *t;
+  uint64 wait, hold, swait[NLOCKSITE];
+  int i, c, j, k, min;
+
+  for(i = 0; i < n && i < lockstats.n; i++){
+    s = &lockstats.stat[i];
+    t = &st[i];
+    memset(t, 0, sizeof(*t));
+    safestrcpy(t->name, s->name, sizeof(t->name));
+    t->sleep = s->sleep;
+    wait = hold = 0;
+    memset(swait, 0, sizeof(swait));
+    for(c = 0; c < ncpu; c++){
+      t->nacquire += s->cpu[c].nacquire;
+      t->ncontend += s->cpu[c].ncontend;
+      wait += s->cpu[c].wait;
+      hold += s->cpu[c].hold;
+
+      // Merge the CPU's sites into the top NLOCKSITE.
+      for(j = 0; j < NLOCKSITE && s->cpu[c].site[j].pc; j++){
+        min = 0;
+        for(k = 0; k < NLOCKSITE; k++){
+          if(t->site[k].pc == s->cpu[c].site[j].pc)
+            break;
+          if(swait[k] < swait[min])
+            min = k;
+        }
+        if(k == NLOCKSITE){
+          if(swait[min] >= s->cpu[c].site[j].wait)
+            continue;
+          k = min;
+          t->site[k].pc = s->cpu[c].site[j].pc;
+          t->site[k].n = 0;
+          swait[k] = 0;
+        }
+        t->site[k].n += s->cpu[c].site[j].n;
+        swait[k] += s->cpu[c].site[j].wait;
+      }
+    }
+    t->kwait = wait >> 10;
+    t->khold = hold >> 10;
+    for(k = 0; k < NLOCKSITE; k++)
+      t->site[k].kwait = swait[k] >> 10;
+  }
+  return i;
+}
+
 // Record the current call stack in pcs[] by following the %ebp chain.
 void
 getcallerpcs(void *v, uint pcs[])
@@ -1,6 +1,13 @@
-// Mutual exclusion lock.
+// Mutual exclusion lock: a ticket lock. acquire() takes the
+// next ticket and waits until serving reaches it, so CPUs get
+// the lock in the order they asked for it, and waiting only
+// reads the lock; release() hands it on by advancing serving.
 struct spinlock {
+  uint next;         // Next ticket to hand out
+  uint serving;      // Ticket allowed to hold the lock
   uint locked;       // Is the lock held?
+  struct lockstats *stat; // Profile of the locks of this name
+  uint64 tacquire;   // rdtsc when acquired
 
   // For debugging:
   char *name;        // Name of lock.
@@ -8,4 +15,3 @@ struct spinlock {
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
 };
-
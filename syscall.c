@@ -13,13 +13,31 @@
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
+// Return the end of the user region containing addr:
+// either the heap/stack image or an mmap() region.
+// Returns 0 if addr is not mapped.
+static uint
+uregionend(struct proc *p, uint addr)
+{
+  struct vma *v;
+
+  if(addr < p->sz)
+    return p->sz;
+  if((v = findvma(p, addr)) != 0)
+    return v->end;
+  return 0;
+}
+
 // Fetch the int at addr from the current process.
 int
 fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
+  uint end = uregionend(curproc, addr);
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(end == 0 || addr+4 > end || addr+4 < addr)
+    return -1;
+  if(pagein(addr, 4, 0) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -34,11 +52,12 @@ fetchstr(uint addr, char **pp)
   char *s, *ep;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
+  if((ep = (char*)uregionend(curproc, addr)) == 0)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && pagein((uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -59,11 +78,15 @@ int
 argptr(int n, char **pp, int size)
 {
   int i;
+  uint end;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  end = uregionend(curproc, i);
+  if(size < 0 || end == 0 || (uint)i+size > end || (uint)i+size < (uint)i)
+    return -1;
+  if(pagein(i, size, 0) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -105,6 +128,12 @@ extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_verbose(void);
 extern int sys_meminfo(void);
+extern int sys_getlockstat(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -130,6 +159,12 @@ static int (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_verbose] sys_verbose,
 [SYS_meminfo] sys_meminfo,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_getlockstat] sys_getlockstat,
 };
 
 void
@@ -21,4 +21,10 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_verbose 22
-#define SYS_meminfo 23
\ No newline at end of file
+#define SYS_meminfo 23
+#define SYS_mmap   24
+#define SYS_munmap 25
+#define SYS_shmget 26
+#define SYS_shmat  27
+#define SYS_shmdt  28
+#define SYS_getlockstat 29
\ No newline at end of file
@@ -75,6 +75,8 @@ sys_read(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
     return -1;
+  if(pagein((uint)p, n, 1) < 0)
+    return -1;
   return fileread(f, p, n);
 }
 
@@ -111,6 +113,8 @@ sys_fstat(void)
 
   if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
+  if(pagein((uint)st, sizeof(*st), 1) < 0)
+    return -1;
   return filestat(f, st);
 }
 
@@ -218,6 +222,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcenter(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -428,6 +433,8 @@ sys_pipe(void)
 
   if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
+  if(pagein((uint)fd, 2*sizeof(fd[0]), 1) < 0)
+    return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
   fd0 = -1;
@@ -442,3 +449,37 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int addr, len, prot, flags, off;
+
+  // addr is only a hint and is ignored.
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argfd(4, 0, &f) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0 || off % PGSIZE != 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  if((prot & PROT_WRITE) && flags == MAP_SHARED && !f->writable)
+    return -1;
+  // Shared mappings live in the page cache.
+  if(flags == MAP_SHARED && (f->ip->type == T_DEV || (f->ip->flags & I_NOCACHE)))
+    return -1;
+  return mmapfile(f->ip, off, len, prot, flags);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmapfile(myproc(), addr, len);
+}
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "lockstat.h"
 
 int
 sys_fork(void)
@@ -55,6 +56,47 @@ int sys_meminfo(void) {
   return 0;
 }
 
+int sys_shmget(void) {
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0 || size <= 0)
+    return -1;
+  return shmget(key, size);
+}
+
+int sys_shmat(void) {
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmat(id);
+}
+
+int sys_shmdt(void) {
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return shmdt(addr);
+}
+
+// Copy contention statistics of up to n lock names to the
+// array at the first argument; returns how many.
+int sys_getlockstat(void) {
+  struct lockstat *st;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NLOCKSTAT)
+    n = NLOCKSTAT;
+  if(argptr(0, (char**)&st, n*sizeof(*st)) < 0)
+    return -1;
+  if(pagein((uint)st, n*sizeof(*st), 1) < 0)
+    return -1;
+  return getlockstat(st, n);
+}
+
 int sys_sbrk(void) {
   int addr;
   int n;
@@ -82,7 +124,7 @@ sys_sleep(void)
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    idlesleep(&ticks, &tickslock);
   }
   release(&tickslock);
   return 0;
@@ -35,6 +35,8 @@ void trap(struct trapframe *tf) {
       exit();
     myproc()->tf = tf;
     syscall();
+    if(myproc()->suspended && !myproc()->killed)
+      suspend();
     if(myproc()->killed)
       exit();
     return;
@@ -98,13 +100,24 @@ void trap(struct trapframe *tf) {
       pgtable_entry = pgtable_base[pgtable_index];
 
       if( (pgtable_entry & PTE_U) && (pgtable_entry & PTE_W) && (pgtable_entry & PTE_PG) ) {
-        swapIn(faultingAddress);
-        if( p->verbose>=2 ) {
-          memSwapInfo(p);
-          cprintf("------------------------------------------------------");
-          cprintf("------------------------------------------------------\n");
+        if( swapIn(faultingAddress) == 0 ) {
+          if( p->verbose>=2 ) {
+            memSwapInfo(p);
+            cprintf("------------------------------------------------------");
+            cprintf("------------------------------------------------------\n");
+          }
+          break;
         }
-        break;
+        // Out of memory: fall through and kill the process.
+      }
+      else if( (pgtable_entry & PTE_U) && (pgtable_entry & PTE_MM) && !(pgtable_entry & PTE_P) ) {
+        if( mmapIn(faultingAddress) == 0 )
+          break;
+        // Out of memory: fall through and kill the process.
+      }
+      else if( (pgtable_entry & PTE_P) && (pgtable_entry & PTE_U) ) {
+        // Protection fault, e.g. a write to a PROT_READ mapping.
+        // Fall through and treat it like any other bad access.
       }
       else {
         panic("T_PGFLT: pgtable_entry invalid");
@@ -113,6 +126,10 @@ void trap(struct trapframe *tf) {
 
   //PAGEBREAK: 13
   default:
+    if(tf->trapno >= T_IRQ0 && virtiointr(tf->trapno - T_IRQ0)){
+      lapiceoi();
+      break;
+    }
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
@@ -133,12 +150,18 @@ void trap(struct trapframe *tf) {
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU on clock tick, once its
+  // quantum is used up or a higher level process waits.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
+     tf->trapno == T_IRQ0+IRQ_TIMER && schedtick())
     yield();
 
+  // Stop here if the swapper suspended the process.
+  if(myproc() && myproc()->suspended && !myproc()->killed &&
+     (tf->cs&3) == DPL_USER)
+    suspend();
+
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
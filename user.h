@@ -1,4 +1,5 @@
 struct stat;
+struct lockstat;
 struct rtcdate;
 
 // system calls
@@ -25,6 +26,12 @@ int sleep(int);
 int uptime(void);
 int verbose(int);
 int meminfo(void);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int shmget(int, int);
+void* shmat(int);
+int shmdt(void*);
+int getlockstat(struct lockstat*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
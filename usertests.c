@@ -184,6 +184,9 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// Enough 512-byte writes to reach the double-indirect blocks.
+#define BIGCHUNKS ((NDIRECT + NINDIRECT + 2) * (BSIZE / 512))
+
 void
 writetest1(void)
 {
@@ -197,7 +200,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGCHUNKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +220,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGCHUNKS){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
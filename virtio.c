@@ -0,0 +1,238 @@
+// Virtio block device driver, for the file system disk under QEMU
+// (see VIRTIO in the Makefile).
+//
+// Unlike the IDE controller, which works on one request at a time,
+// the virtqueue lets many requests be outstanding. Each request is
+// a chain of three descriptors: the header, the block's data and
+// a status byte. Completions come back on the used ring, in any
+// order; the interrupt handler finishes every buf it finds there.
+//
+// iderw() hands bufs for the file system disk to virtiorw() when
+// a virtio-blk device is present.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "virtio.h"
+
+#define SECTOR_SIZE 512
+#define VQMAX       256  // largest ring we have room for
+
+// Legacy rings must be physically contiguous: descriptors, then
+// the available ring, then the used ring at the next VRING_ALIGN.
+static char vqmem[3*PGSIZE] __attribute__((aligned(PGSIZE)));
+
+struct vreq {
+  struct buf *b;
+  struct virtio_blk_outhdr hdr;
+  uchar status;
+};
+
+static struct {
+  struct spinlock lock;
+  ushort iobase;             // 0 if there is no device
+  int irq;
+  uint size;                 // disk size in blocks
+  uint num;                  // ring size
+  struct vring_desc *desc;
+  struct vring_avail *avail;
+  struct vring_used *used;
+  char free[VQMAX];          // descriptor is free?
+  int nfree;
+  ushort usedidx;            // used ring entries seen so far
+  struct vreq req[VQMAX];    // indexed by head descriptor
+} vio;
+
+void
+virtioinit(void)
+{
+  struct pcidev d;
+  uint num, off;
+
+  if(pcifind(VIRTIO_VENDOR, VIRTIO_DEV_BLK, PCI_ANY, PCI_ANY, &d) < 0)
+    return;
+  initlock(&vio.lock, "virtio");
+  pcienable(&d, PCI_CMD_IO|PCI_CMD_MASTER);
+  vio.iobase = pcibar(&d, 0);
+
+  outb(vio.iobase+VIRTIO_STATUS, 0);  // reset
+  outb(vio.iobase+VIRTIO_STATUS, VIRTIO_STATUS_ACK|VIRTIO_STATUS_DRIVER);
+  outl(vio.iobase+VIRTIO_GUEST_FEATURES, 0);  // none needed
+
+  outw(vio.iobase+VIRTIO_QUEUE_SEL, 0);
+  num = inw(vio.iobase+VIRTIO_QUEUE_NUM);
+  off = PGROUNDUP(num*sizeof(struct vring_desc) + (3+num)*sizeof(ushort));
+  if(num == 0 || num > VQMAX ||
+     off + 3*sizeof(ushort) + num*sizeof(struct vring_used_elem) > sizeof(vqmem)){
+    outb(vio.iobase+VIRTIO_STATUS, VIRTIO_STATUS_FAILED);
+    vio.iobase = 0;
+    return;
+  }
+  vio.num = num;
+  memset(vqmem, 0, sizeof(vqmem));
+  vio.desc = (struct vring_desc*)vqmem;
+  vio.avail = (struct vring_avail*)(vqmem + num*sizeof(struct vring_desc));
+  vio.used = (struct vring_used*)(vqmem + off);
+  for(vio.nfree = 0; vio.nfree < num; vio.nfree++)
+    vio.free[vio.nfree] = 1;
+  outl(vio.iobase+VIRTIO_QUEUE_PFN, V2P(vqmem) / VRING_ALIGN);
+
+  // The configuration starts with the 64-bit capacity in sectors.
+  vio.size = inl(vio.iobase+VIRTIO_CONFIG) / (BSIZE / SECTOR_SIZE);
+  vio.irq = d.irq;
+  ioapicenable(vio.irq, ncpu - 1);
+  outb(vio.iobase+VIRTIO_STATUS,
+       VIRTIO_STATUS_ACK|VIRTIO_STATUS_DRIVER|VIRTIO_STATUS_OK);
+}
+
+// Take a free descriptor. Caller holds vio.lock.
+static int
+allocdesc(void)
+{
+  int i;
+
+  for(i = 0; i < vio.num; i++){
+    if(vio.free[i]){
+      vio.free[i] = 0;
+      vio.nfree--;
+      return i;
+    }
+  }
+  panic("virtio: allocdesc");
+}
+
+// Free the descriptor chain that starts at i.
+// Caller holds vio.lock.
+static void
+freechain(int i)
+{
+  int flags;
+
+  for(;;){
+    flags = vio.desc[i].flags;
+    vio.free[i] = 1;
+    vio.nfree++;
+    if(!(flags & VRING_DESC_F_NEXT))
+      break;
+    i = vio.desc[i].next;
+  }
+  wakeup(&vio.free);
+}
+
+static void
+setdesc(int i, void *addr, uint len, int flags, int next)
+{
+  vio.desc[i].addr = V2P(addr);
+  vio.desc[i].addrhi = 0;
+  vio.desc[i].len = len;
+  vio.desc[i].flags = flags;
+  vio.desc[i].next = next;
+}
+
+// Queue the request for b on the virtqueue. If b->flags has
+// B_ASYNC, return at once, as iderw() does; otherwise wait
+// for the request to finish. Returns -1 if there is no
+// virtio disk for b.
+int
+virtiorw(struct buf *b)
+{
+  int d0, d1, d2;
+  struct vreq *r;
+
+  if(vio.iobase == 0 || b->dev != ROOTDEV)
+    return -1;
+  if(b->blockno >= vio.size)
+    panic("virtio: blockno");
+
+  acquire(&vio.lock);
+  while(vio.nfree < 3)
+    sleep(&vio.free, &vio.lock);
+  d0 = allocdesc();
+  d1 = allocdesc();
+  d2 = allocdesc();
+
+  r = &vio.req[d0];
+  r->b = b;
+  r->hdr.type = (b->flags & B_DIRTY) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  r->hdr.reserved = 0;
+  r->hdr.sector = b->blockno * (BSIZE / SECTOR_SIZE);
+  r->hdr.sectorhi = 0;
+  r->status = 0xff;
+  setdesc(d0, &r->hdr, sizeof(r->hdr), VRING_DESC_F_NEXT, d1);
+  setdesc(d1, b->data, BSIZE,
+          VRING_DESC_F_NEXT | ((b->flags & B_DIRTY) ? 0 : VRING_DESC_F_WRITE), d2);
+  setdesc(d2, &r->status, 1, VRING_DESC_F_WRITE, 0);
+
+  vio.avail->ring[vio.avail->idx % vio.num] = d0;
+  __sync_synchronize();   // ring entry before index
+  vio.avail->idx++;
+  __sync_synchronize();   // index before notify
+  outw(vio.iobase+VIRTIO_QUEUE_NOTIFY, 0);
+
+  if(!(b->flags & B_ASYNC)){
+    while(!(b->flags & B_ERROR) && (b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+      sleep(b, &vio.lock);
+  }
+  release(&vio.lock);
+  return 0;
+}
+
+// Are requests outstanding? For idebusy().
+int
+virtiobusy(void)
+{
+  return vio.iobase != 0 && vio.nfree < vio.num;
+}
+
+// Interrupt handler. Returns 0 if irq is not ours.
+int
+virtiointr(int irq)
+{
+  struct buf *b, *async;
+  struct vreq *r;
+  int id;
+
+  if(vio.iobase == 0 || irq != vio.irq)
+    return 0;
+
+  acquire(&vio.lock);
+  inb(vio.iobase+VIRTIO_ISR);   // acknowledge first, then look
+  async = 0;
+  while(vio.usedidx != vio.used->idx){
+    __sync_synchronize();
+    id = vio.used->ring[vio.usedidx % vio.num].id;
+    vio.usedidx++;
+    r = &vio.req[id];
+    b = r->b;
+    // Keep the asynchronous bufs on a list of our own.
+    if(b->flags & B_ASYNC){
+      b->qnext = async;
+      async = b;
+    }
+    if(r->status != VIRTIO_BLK_S_OK)
+      b->flags |= B_ERROR;
+    else
+      b->flags |= B_VALID;
+    b->flags &= ~(B_DIRTY|B_ASYNC);
+    wakeup(b);
+    r->b = 0;
+    freechain(id);
+  }
+  release(&vio.lock);
+
+  // As in ideintr(), give asynchronous bufs back to the cache.
+  for(; async; async = b){
+    b = async->qnext;
+    bdone(async);
+  }
+  return 1;
+}
@@ -0,0 +1,62 @@
+// Virtio over PCI, legacy (0.9.5) interface, as offered by
+// QEMU's transitional devices (disable-modern=on).
+
+#define VIRTIO_VENDOR        0x1AF4
+#define VIRTIO_DEV_BLK       0x1001  // transitional block device
+
+// Legacy I/O registers, from BAR0.
+#define VIRTIO_HOST_FEATURES 0x00  // 32
+#define VIRTIO_GUEST_FEATURES 0x04 // 32
+#define VIRTIO_QUEUE_PFN     0x08  // 32, physical page number of the ring
+#define VIRTIO_QUEUE_NUM     0x0C  // 16, ring size (read only)
+#define VIRTIO_QUEUE_SEL     0x0E  // 16
+#define VIRTIO_QUEUE_NOTIFY  0x10  // 16
+#define VIRTIO_STATUS        0x12  // 8
+#define VIRTIO_ISR           0x13  // 8, reading acknowledges the interrupt
+#define VIRTIO_CONFIG        0x14  // device-specific configuration
+
+// Device status bits
+#define VIRTIO_STATUS_ACK    1
+#define VIRTIO_STATUS_DRIVER 2
+#define VIRTIO_STATUS_OK     4
+#define VIRTIO_STATUS_FAILED 128
+
+#define VRING_ALIGN          4096
+
+struct vring_desc {
+  uint addr;           // 64-bit physical address
+  uint addrhi;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+#define VRING_DESC_F_NEXT    1  // chained with next
+#define VRING_DESC_F_WRITE   2  // device writes (vs reads)
+
+struct vring_avail {
+  ushort flags;
+  ushort idx;
+  ushort ring[];
+};
+
+struct vring_used_elem {
+  uint id;             // head of the finished descriptor chain
+  uint len;
+};
+
+struct vring_used {
+  ushort flags;
+  ushort idx;
+  struct vring_used_elem ring[];
+};
+
+// Block request header, read by the device.
+struct virtio_blk_outhdr {
+  uint type;
+  uint reserved;
+  uint sector;         // 64-bit sector number
+  uint sectorhi;
+};
+#define VIRTIO_BLK_T_IN      0  // read
+#define VIRTIO_BLK_T_OUT     1  // write
+#define VIRTIO_BLK_S_OK      0  // status byte of a request that succeeded
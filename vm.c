@@ -6,9 +6,16 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+#include "shm.h"
 
 extern char data[]; // defined by kernel.ld
 pde_t *kpgdir;      // for use in scheduler()
+uint nfaults;       // page faults that went to disk, for the swapper
 
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
@@ -174,6 +181,15 @@ void switchuvm(struct proc *p)
   popcli();
 }
 
+// Switch straight from the running process to p, as sched()
+// does. This CPU's TSS is loaded already (see switchuvm), so
+// only the kernel stack for traps and the page table change.
+void switchuvmfast(struct proc *p)
+{
+  mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+  lcr3(V2P(p->pgdir));
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void inituvm(pde_t *pgdir, char *init, uint sz)
@@ -250,12 +266,39 @@ uint getEvictedVa(struct proc *p) {
   return evictedVa;
 }
 
+static void mmapDirty(struct vma *v, uint va);
+
 void swapOut(struct proc *p) {
   uint evictedVa = getEvictedVa(p);
+  struct vma *v;
 
   if (evictedVa % 4096 != 0)
     panic("swapOut: invalid evictedVa");
 
+  pte_t *pte = walkpgdir(p->pgdir, (char *)evictedVa, 0);
+  if (pte == 0)
+    panic("SWAP OUT: page to be evicted does not exist");
+
+  uint pa = (*pte) & ~0xFFF;
+
+  // A file-backed page never goes to the swap file: a clean one can be
+  // read back from the file, and a shared one stays in the page cache,
+  // which is told if it is dirty. Only dirty private copies are treated
+  // as anonymous.
+  v = findvma(p, evictedVa);
+  if ((*pte & PTE_MM) && v && (!(*pte & PTE_D) || (*pte & PTE_SH)))
+  {
+    if( p->verbose>=1 ) {
+      cprintf("Dropping File Page %d, PID: %d\n", evictedVa>>12, p->pid);
+    }
+    if (*pte & PTE_D)
+      mmapDirty(v, evictedVa);
+    kfree(P2V(pa));
+    *pte = (*pte & PTE_W) | PTE_U | PTE_MM;
+    lcr3(V2P(p->pgdir));
+    return;
+  }
+
   if( p->verbose>=1 ) {
     cprintf("Swapping Out Page %d, PID: %d\n", evictedVa>>12, p->pid);
   }
@@ -264,18 +307,13 @@ void swapOut(struct proc *p) {
   {
     if (p->swapMap[i] == 1)
     {
-      writeToSwapFile(p, (char *)evictedVa, i * PGSIZE, PGSIZE);
+      writeToSwapFile(p, P2V(pa), i * PGSIZE, PGSIZE);
       p->swapMap[i] = evictedVa;
       p->swapPageCount++;
       break;
     }
   }
 
-  pte_t *pte = walkpgdir(p->pgdir, (char *)evictedVa, 0);
-  if (pte == 0)
-    panic("SWAP OUT: page to be evicted does not exist");
-
-  uint pa = (*pte) & ~0xFFF;
   kfree(P2V(pa));
   *pte = PTE_W | PTE_U | PTE_PG;
 
@@ -326,6 +364,36 @@ int allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Drop va from p's list of resident pages.
+static void forgetMemPage(struct proc *p, uint va) {
+  for (int i = 0; i < p->memPageCount; i++)
+  {
+    if (p->pagesFIFO[i] == va)
+    {
+      for (int j = i; j < p->memPageCount - 1; j++)
+      {
+        p->pagesFIFO[j] = p->pagesFIFO[j + 1];
+        p->pagesAge[j] = p->pagesAge[j + 1];
+      }
+      p->memPageCount--;
+      break;
+    }
+  }
+}
+
+// Release the swap file slot holding va.
+static void forgetSwapPage(struct proc *p, uint va) {
+  for (int i = 0; i < MAX_SWAP_PAGES; i++)
+  {
+    if (p->swapMap[i] == va)
+    {
+      p->swapMap[i] = 1;
+      p->swapPageCount--;
+      break;
+    }
+  }
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -354,37 +422,13 @@ int deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       char *v = P2V(pa);
       kfree(v);
       if (isUserProc(p))
-      {
-        for (int i = 0; i < p->memPageCount; i++)
-        {
-          if (p->pagesFIFO[i] == a)
-          {
-            for (int j = i; j < p->memPageCount - 1; j++)
-            {
-              p->pagesFIFO[j] = p->pagesFIFO[j + 1];
-              p->pagesAge[j] = p->pagesAge[j + 1];
-            }
-            p->memPageCount--;
-            break;
-          }
-        }
-      }
+        forgetMemPage(p, a);
       *pte = 0;
     }
     else if ((*pte & PTE_PG) != 0)
     {
       if (isUserProc(p))
-      {
-        for (int i = 0; i < MAX_SWAP_PAGES; i++)
-        {
-          if (p->swapMap[i] == a)
-          {
-            p->swapMap[i] = 1;
-            p->swapPageCount--;
-            break;
-          }
-        }
-      }
+        forgetSwapPage(p, a);
     }
   }
   return newsz;
@@ -422,26 +466,23 @@ void clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
-// Given a parent process's page table, create a copy
-// of it for a child.
-pde_t *copyuvm(pde_t *pgdir, uint sz) {
-  struct proc *p = getProcFromPgdir(pgdir);
-
-  pde_t *d;
+// Copy the pages of [start, end) from pgdir into the child table d.
+// Returns -1 if memory runs out.
+static int copyrange(struct proc *p, pde_t *pgdir, pde_t *d, uint start, uint end) {
   pte_t *pte;
   uint pa, i, flags;
   char *mem;
 
-  if ((d = setupkvm()) == 0)
-    return 0;
-  for (i = 0; i < sz; i += PGSIZE)
+  for (i = start; i < end; i += PGSIZE)
   {
     if ((pte = walkpgdir(pgdir, (void *)i, 0)) == 0)
       panic("copyuvm: pte should exist");
-    if( isUserProc(p) ) {
-      if(*pte & PTE_PG) {
-        pte = walkpgdir(d, (int*)i, 1);
-        *pte = PTE_PG | PTE_U | PTE_W;
+    if( isUserProc(p) || (*pte & PTE_MM) ) {
+      if( (*pte & PTE_PG) || ((*pte & PTE_MM) && !(*pte & PTE_P)) ) {
+        flags = PTE_FLAGS(*pte);
+        if ((pte = walkpgdir(d, (int*)i, 1)) == 0)
+          return -1;
+        *pte = flags;
         continue;
       }
     }
@@ -449,15 +490,46 @@ pde_t *copyuvm(pde_t *pgdir, uint sz) {
       panic("copyuvm: page not present");
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
+    if ((flags & PTE_SH) || ((flags & PTE_MM) && !(flags & PTE_W)))
+    {
+      // Shared memory, a shared file page, or a read-only file
+      // page: the child maps the same frame.
+      if (mappages(d, (void *)i, PGSIZE, pa, flags) < 0)
+        return -1;
+      kincref(P2V(pa));
+      continue;
+    }
     if ((mem = kalloc()) == 0)
-      goto bad;
+      return -1;
     memmove(mem, (char *)P2V(pa), PGSIZE);
     if (mappages(d, (void *)i, PGSIZE, V2P(mem), flags) < 0)
     {
       kfree(mem);
-      goto bad;
+      return -1;
     }
   }
+  return 0;
+}
+
+// Given a parent process's page table, create a copy
+// of it for a child. mmap() regions are copied too;
+// the caller duplicates the vma descriptors.
+pde_t *copyuvm(pde_t *pgdir, uint sz) {
+  struct proc *p = getProcFromPgdir(pgdir);
+  pde_t *d;
+
+  if ((d = setupkvm()) == 0)
+    return 0;
+  if (copyrange(p, pgdir, d, 0, sz) < 0)
+    goto bad;
+  for (int i = 0; i < NVMA; i++)
+  {
+    // Program segments lie below sz and are copied above.
+    if (p->vmas[i].end == 0 || p->vmas[i].start < MMAPBASE)
+      continue;
+    if (copyrange(p, pgdir, d, p->vmas[i].start, p->vmas[i].end) < 0)
+      goto bad;
+  }
   return d;
 
 bad:
@@ -546,7 +618,7 @@ void printPagingInfo(struct proc *p) {
       {
         pgtable_entry = pgtable_base[pgtable_index];
 
-        if ((pgtable_entry & PTE_P) && (pgtable_entry & PTE_U) && !(pgtable_entry & PTE_PG))
+        if ((pgtable_entry & PTE_P) && (pgtable_entry & PTE_U) && !(pgtable_entry & PTE_PG) && !(pgtable_entry & PTE_SH))
         {
 
           if (pgdir_entry_present == 0)
@@ -559,8 +631,12 @@ void printPagingInfo(struct proc *p) {
           page_PPN = pgtable_entry >> 12;
           cprintf("\n\t\tptbl PTE %d, %d, %d", pgtable_index, page_PPN, page_PPN << 12);
 
-          mappings[map_idx][0] = pgdir_index * 1024 + pgtable_index;
-          mappings[map_idx++][1] = page_PPN;
+          if (map_idx < MAX_PSYC_PAGES)
+          {
+            mappings[map_idx][0] = pgdir_index * 1024 + pgtable_index;
+            mappings[map_idx][1] = page_PPN;
+          }
+          map_idx++;
         }
       }
     }
@@ -575,7 +651,9 @@ void printPagingInfo(struct proc *p) {
   }
 }
 
-void swapIn(uint faultingVa) {
+// Bring back the swapped-out page at faultingVa. Returns -1 if
+// memory runs out.
+int swapIn(uint faultingVa) {
   struct proc *p = myproc();
 
   if (p->memPageCount == MAX_PSYC_PAGES) {
@@ -594,6 +672,8 @@ void swapIn(uint faultingVa) {
       }
 
       char *mem = kalloc();
+      if (mem == 0)
+        return -1;
       memset(mem, 0, PGSIZE);
       lcr3(V2P(p->pgdir));
 
@@ -619,7 +699,597 @@ void swapIn(uint faultingVa) {
       p->memPageCount++;
       p->pagesFIFO[p->memPageCount - 1] = faultingVa;
       p->pagesAge[p->memPageCount - 1] = 0x80000000;
-      return;
+      nfaults++;
+      return 0;
     }
   }
+
+  // Not in a page slot: it went out with the whole resident set.
+  if (p->suspPageCount > 0)
+    return suspendIn(p);
+  return -1;
+}
+
+// Whole-process swapping.
+//
+// suspendOut() moves the entire resident set of a process to its
+// swap file in one go and frees the frames, for the swapper (see
+// proc.c) to take a process out of the competition for memory.
+// The pages go to a suspend area past the MAX_SWAP_PAGES page
+// slots, so the slots in use stay as they are, and suspMap lists
+// them in order. As in swapOut(), clean and shared file-backed
+// pages are not written there but dropped, and read back from the
+// file or found in the page cache. Pages in the suspend area are
+// marked PTE_PG like swapped out pages, with the rest of their PTE
+// flags kept.
+//
+// Once no page is resident, the page tables of the user part
+// follow the pages into the suspend area; a page directory entry
+// of a table out there holds its number in the area and PTE_PG.
+//
+// suspendIn() brings all of it back before the process runs user
+// code again. It runs in the process itself, with no locks held,
+// and starts reading the whole area at once, so that the disk
+// gets one batch of requests it can merge instead of one page at
+// a time.
+#define SUSPOFF(i) ((MAX_SWAP_PAGES + (i)) * PGSIZE)
+#define SUSPFILE 1   // suspMap entry is a dropped file page
+
+// Move the resident set of p, which is not running user code,
+// to the suspend area. Returns the number of pages moved.
+int suspendOut(struct proc *p) {
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  uint va, sz, pdx;
+  int n, slot, k;
+
+  if (!isUserProc(p) || p->swapFile == 0 || p->suspPageCount > 0 || p->suspTableCount > 0)
+    return 0;
+
+  // writei() cannot leave holes: extend the file over page
+  // slots that were never used.
+  if ((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  while ((sz = p->swapFile->ip->size) < SUSPOFF(0))
+  {
+    if (writeToSwapFile(p, mem, sz, PGSIZE - sz % PGSIZE) <= 0)
+    {
+      kfree(mem);
+      return 0;
+    }
+  }
+  kfree(mem);
+
+  setpgbusy(p, 1);
+  n = slot = 0;
+  while (p->memPageCount > 0)
+  {
+    va = p->pagesFIFO[p->memPageCount - 1];
+    pte = walkpgdir(p->pgdir, (char *)va, 0);
+    if (pte == 0 || !(*pte & PTE_P))
+      panic("suspendOut: page not present");
+    mem = P2V(PTE_ADDR(*pte));
+
+    v = findvma(p, va);
+    if ((*pte & PTE_MM) && v && (!(*pte & PTE_D) || (*pte & PTE_SH)))
+    {
+      if (*pte & PTE_D)
+        mmapDirty(v, va);
+      *pte = (*pte & PTE_W) | PTE_U | PTE_MM;
+      p->suspMap[n++] = va | SUSPFILE;
+    }
+    else
+    {
+      if (writeToSwapFile(p, mem, SUSPOFF(slot), PGSIZE) != PGSIZE)
+        break;
+      *pte = (PTE_FLAGS(*pte) & ~PTE_P) | PTE_PG;
+      p->suspMap[n++] = va;
+      slot++;
+    }
+    kfree(mem);
+    p->memPageCount--;
+  }
+  p->suspPageCount = n;
+
+  // The page tables now map nothing but shared memory
+  // segments, whose frames stay where they are.
+  k = 0;
+  for (pdx = 0; p->memPageCount == 0 && pdx < PDX(KERNBASE); pdx++)
+  {
+    if (!(p->pgdir[pdx] & PTE_P))
+      continue;
+    mem = P2V(PTE_ADDR(p->pgdir[pdx]));
+    if (writeToSwapFile(p, mem, SUSPOFF(slot + k), PGSIZE) != PGSIZE)
+      break;
+    p->pgdir[pdx] = (k * PGSIZE) | PTE_PG;
+    kfree(mem);
+    k++;
+  }
+  p->suspTableCount = k;
+
+  if( p->verbose>=1 ) {
+    cprintf("Suspended %d Pages, %d Page Tables, PID: %d\n", n, k, p->pid);
+  }
+
+  // A process that is not running has no TLB entries left.
+  if (p == myproc())
+    lcr3(V2P(p->pgdir));
+  setpgbusy(p, 0);
+  return n;
+}
+
+// Bring back the pages and page tables suspendOut() moved
+// out. p is the current process. Returns -1, with p still
+// suspended, if there is not enough memory for all of it.
+int suspendIn(struct proc *p) {
+  char *mem[MAX_PSYC_PAGES], *pt, *frames;
+  pte_t *pte;
+  uint va, pdx;
+  int i, nslot, slot;
+
+  nslot = 0;
+  for (i = 0; i < p->suspPageCount; i++)
+    if (!(p->suspMap[i] & SUSPFILE))
+      nslot++;
+
+  // Take every frame needed before changing anything, so that
+  // running short leaves the process as it was. The spare
+  // frames are chained through their first word.
+  frames = 0;
+  for (i = 0; i < nslot + p->suspTableCount; i++)
+  {
+    if ((pt = kalloc()) == 0)
+    {
+      while ((pt = frames) != 0)
+      {
+        frames = *(char **)pt;
+        kfree(pt);
+      }
+      return -1;
+    }
+    *(char **)pt = frames;
+    frames = pt;
+  }
+  prefetchSwapFile(p, SUSPOFF(0), (nslot + p->suspTableCount) * PGSIZE);
+  setpgbusy(p, 1);
+
+  // Read in the order of the area: pages, then tables.
+  for (slot = 0; slot < nslot; slot++)
+  {
+    mem[slot] = frames;
+    frames = *(char **)frames;
+    if (readFromSwapFile(p, mem[slot], SUSPOFF(slot), PGSIZE) != PGSIZE)
+      panic("suspendIn: Failed to Read from File");
+  }
+  for (pdx = 0; p->suspTableCount > 0 && pdx < PDX(KERNBASE); pdx++)
+  {
+    if ((p->pgdir[pdx] & (PTE_P | PTE_PG)) != PTE_PG)
+      continue;
+    pt = frames;
+    frames = *(char **)frames;
+    if (readFromSwapFile(p, pt, SUSPOFF(nslot + PTE_ADDR(p->pgdir[pdx]) / PGSIZE), PGSIZE) != PGSIZE)
+      panic("suspendIn: Failed to Read from File");
+    p->pgdir[pdx] = V2P(pt) | PTE_P | PTE_W | PTE_U;
+  }
+  p->suspTableCount = 0;
+
+  slot = 0;
+  for (i = 0; i < p->suspPageCount; i++)
+  {
+    if (p->suspMap[i] & SUSPFILE)
+      continue;
+    va = p->suspMap[i];
+    pte = walkpgdir(p->pgdir, (char *)va, 0);
+    if (pte == 0 || !(*pte & PTE_PG))
+      panic("suspendIn: page not suspended");
+    *pte = V2P(mem[slot++]) | (PTE_FLAGS(*pte) & ~PTE_PG) | PTE_P;
+
+    p->pagesFIFO[p->memPageCount] = va;
+    p->pagesAge[p->memPageCount] = 0x80000000;
+    p->memPageCount++;
+  }
+  lcr3(V2P(p->pgdir));
+  setpgbusy(p, 0);
+
+  // File pages last: mmapIn() counts them in.
+  for (i = 0; i < p->suspPageCount; i++)
+  {
+    if (p->suspMap[i] & SUSPFILE)
+      mmapIn(p->suspMap[i] & ~SUSPFILE);
+  }
+
+  if( p->verbose>=1 ) {
+    cprintf("Resumed %d Pages, PID: %d\n", p->suspPageCount, p->pid);
+  }
+
+  p->suspPageCount = 0;
+  return 0;
+}
+
+// Memory-mapped files.
+//
+// mmapfile() only reserves address space: every page of the region
+// gets a non-present PTE_MM entry, in the same spirit as PTE_PG for
+// swapped-out pages. The first touch faults into mmapIn(), which
+// reads the page straight from the file into a fresh frame. exec()
+// maps program segments the same way.
+//
+// A page that can never be written (no PTE_W) is not copied at all:
+// it maps the page cache's own frame, so every process running the
+// same program shares one copy of its text.
+//
+// MAP_SHARED pages inside the file map that frame too, writable or
+// not, with PTE_SH so that fork() shares them as well. Stores then
+// show up at once in read() and in every other mapping. When a
+// process drops such a page dirty, the page cache keeps it until
+// munmap() (or exit) writes it back with mmapWriteBack().
+
+// Return the mmap() region of p containing va, or 0.
+struct vma *findvma(struct proc *p, uint va) {
+  for (int i = 0; i < NVMA; i++)
+  {
+    if (p->vmas[i].end && va >= p->vmas[i].start && va < p->vmas[i].end)
+      return &p->vmas[i];
+  }
+  return 0;
+}
+
+// Pick a free vma slot of p and an address range of len bytes
+// above every existing region. Returns 0 if there is neither.
+static struct vma *vmaalloc(struct proc *p, uint len, uint *startp) {
+  struct vma *v = 0;
+  uint start, end;
+
+  start = MMAPBASE;
+  for (int i = 0; i < NVMA; i++)
+  {
+    if (p->vmas[i].end == 0)
+    {
+      if (v == 0)
+        v = &p->vmas[i];
+    }
+    else if (p->vmas[i].end > start)
+      start = p->vmas[i].end;
+  }
+  end = start + PGROUNDUP(len);
+  if (v == 0 || len == 0 || end <= start || end > KERNBASE)
+    return 0;
+  *startp = start;
+  return v;
+}
+
+// Give every page of [start, end) in pgdir a non-present PTE_MM
+// entry, writable if prot has PROT_WRITE. Returns -1 if a page
+// table cannot be allocated.
+int reserveuvm(pde_t *pgdir, uint start, uint end, int prot) {
+  uint a;
+  pte_t *pte;
+
+  for (a = start; a < end; a += PGSIZE)
+  {
+    if ((pte = walkpgdir(pgdir, (char *)a, 1)) == 0)
+    {
+      while (a > start)
+      {
+        a -= PGSIZE;
+        *walkpgdir(pgdir, (char *)a, 0) = 0;
+      }
+      return -1;
+    }
+    *pte = PTE_U | PTE_MM | ((prot & PROT_WRITE) ? PTE_W : 0);
+  }
+  return 0;
+}
+
+// Map len bytes of ip, starting at page-aligned file offset off,
+// above MMAPBASE in the current process.
+// Returns the start address, or -1.
+int mmapfile(struct inode *ip, uint off, uint len, int prot, int flags) {
+  struct proc *p = myproc();
+  struct vma *v;
+  uint start, end;
+
+  if ((v = vmaalloc(p, len, &start)) == 0)
+    return -1;
+  end = start + PGROUNDUP(len);
+  if (reserveuvm(p->pgdir, start, end, prot) < 0)
+    return -1;
+
+  v->start = start;
+  v->end = end;
+  v->off = off;
+  v->filesz = end - start;
+  v->prot = prot;
+  v->flags = flags;
+  v->ip = idup(ip);
+  v->shm = 0;
+  return start;
+}
+
+// Bring in the non-present pages of [va, va+len) of the current
+// process, so that a system call can copy to or from them while
+// holding a spinlock, where a page fault could not sleep.
+// If write is set, returns -1 if some page is read-only: the
+// kernel would fault writing to it. Also returns -1 if a page
+// cannot be brought in.
+int pagein(uint va, uint len, int write) {
+  struct proc *p = myproc();
+  pte_t *pte;
+
+  for (uint a = PGROUNDDOWN(va); a < va + len; a += PGSIZE)
+  {
+    if ((pte = walkpgdir(p->pgdir, (char *)a, 0)) == 0 || !(*pte & PTE_U))
+      continue;
+    if (write && !(*pte & PTE_W))
+      return -1;
+    if ((*pte & PTE_W) && (*pte & PTE_PG))
+    {
+      if (swapIn(a) < 0)
+        return -1;
+    }
+    else if ((*pte & PTE_MM) && !(*pte & PTE_P))
+    {
+      if (mmapIn(a) < 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+// The page at va of shared mapping v, whose frame is the page
+// cache's, was stored to: have the cache keep it for
+// mmapWriteBack().
+static void mmapDirty(struct vma *v, uint va) {
+  pcdirty(v->ip->dev, v->ip->inum, (v->off + (va - v->start)) / PGSIZE);
+}
+
+// Write the dirty pages of [start, end) of shared mapping v back
+// to the file. Only the part that lies inside the file is written:
+// a mapping never grows the file.
+static void mmapWriteBack(struct vma *v, uint start, uint end) {
+  // Same per-transaction limit as filewrite().
+  uint max = ((MAXOPBLOCKS-1-1-1-2) / 2) * BSIZE;
+  uint va, off, tot, n;
+  char *mem;
+
+  for (va = start; va < end; va += PGSIZE)
+  {
+    off = v->off + (va - v->start);
+    if ((mem = pcclean(v->ip->dev, v->ip->inum, off / PGSIZE)) == 0)
+      continue;
+    for (tot = 0; tot < PGSIZE; tot += n)
+    {
+      begin_op();
+      ilock(v->ip);
+      n = 0;
+      if (off + tot < v->ip->size)
+      {
+        n = v->ip->size - (off + tot);
+        if (n > PGSIZE - tot)
+          n = PGSIZE - tot;
+        if (n > max)
+          n = max;
+        writei(v->ip, mem + tot, off + tot, n);
+      }
+      iunlock(v->ip);
+      end_op();
+      if (n == 0)
+        break;
+    }
+    kfree(mem);
+  }
+}
+
+// Fill in the page of a file-backed region that faultingVa falls in.
+// Returns -1 if the address is not mapped or memory runs out.
+int mmapIn(uint faultingVa) {
+  struct proc *p = myproc();
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  uint off, n;
+  int shared;
+
+  faultingVa = PGROUNDDOWN(faultingVa);
+  if ((v = findvma(p, faultingVa)) == 0 || v->shm)
+    return -1;
+  pte = walkpgdir(p->pgdir, (char *)faultingVa, 0);
+  if (pte == 0 || (*pte & PTE_P))
+    panic("mmapIn: bad pte");
+
+  // Same limit as allocuvm(): a private page that gets
+  // dirty may have to go to the swap file.
+  if (isUserProc(p) && p->memPageCount + p->swapPageCount == MAX_TOTAL_PAGES)
+    return -1;
+  if (isUserProc(p) && p->memPageCount == MAX_PSYC_PAGES) {
+    if( p->verbose>=1 ) cprintf("\n");
+    swapOut(p);
+  }
+
+  // Bytes of the page that come from the file. The rest is zero,
+  // as is anything past end of file (readi stops there).
+  off = faultingVa - v->start;
+  n = 0;
+  if (off < v->filesz)
+    n = v->filesz - off < PGSIZE ? v->filesz - off : PGSIZE;
+
+  // Shared mappings of the file's pages, and read-only private
+  // mappings of whole pages, map the page cache's frame itself;
+  // a shared one has no other choice. Anything else gets a copy.
+  ilock(v->ip);
+  mem = 0;
+  shared = (v->flags & MAP_SHARED) && v->off + off < v->ip->size;
+  if (shared || (!(*pte & PTE_W) && n == PGSIZE))
+    mem = readipage(v->ip, (v->off + off) / PGSIZE);
+  if (mem == 0 && !shared && (mem = kalloc()) != 0)
+  {
+    memset(mem, 0, PGSIZE);
+    if (n > 0)
+      readi(v->ip, mem, v->off + off, n);
+  }
+  iunlock(v->ip);
+  if (mem == 0)
+    return -1;
+  if (n > 0)
+    nfaults++;
+
+  *pte = V2P(mem) | PTE_P | PTE_U | PTE_MM | (*pte & PTE_W) | (shared ? PTE_SH : 0);
+
+  if( p->verbose>=1 ) {
+    cprintf("Mapping In File Page: %d, PID: %d\n", faultingVa>>12, p->pid);
+  }
+
+  if (isUserProc(p))
+  {
+    p->pagesFIFO[p->memPageCount] = faultingVa;
+    p->pagesAge[p->memPageCount] = 0x80000000;
+    p->memPageCount++;
+  }
+  return 0;
+}
+
+// Unmap [addr, addr+len) of the region containing addr.
+// The range must start or end the region; dirty pages of
+// shared mappings are written back.
+int munmapfile(struct proc *p, uint addr, uint len) {
+  struct vma *v;
+  uint a, end;
+  pte_t *pte;
+
+  if (addr % PGSIZE != 0 || len == 0)
+    return -1;
+  if ((v = findvma(p, addr)) == 0 || v->shm || v->start < MMAPBASE)
+    return -1;
+  end = PGROUNDUP(addr + len);
+  if (end <= addr || end > v->end)
+    return -1;
+  if (addr != v->start && end != v->end)
+    return -1;
+
+  for (a = addr; a < end; a += PGSIZE)
+  {
+    if ((pte = walkpgdir(p->pgdir, (char *)a, 0)) == 0)
+      continue;
+    if (*pte & PTE_P)
+    {
+      if ((*pte & PTE_SH) && (*pte & PTE_D))
+        mmapDirty(v, a);
+      kfree(P2V(PTE_ADDR(*pte)));
+      if (isUserProc(p))
+        forgetMemPage(p, a);
+    }
+    else if (*pte & PTE_PG)
+    {
+      if (isUserProc(p))
+        forgetSwapPage(p, a);
+    }
+    *pte = 0;
+  }
+  lcr3(V2P(p->pgdir));
+  if (v->flags & MAP_SHARED)
+    mmapWriteBack(v, addr, end);
+
+  if (addr == v->start)
+  {
+    v->off += end - addr;
+    v->start = end;
+  }
+  else
+    v->end = addr;
+
+  if (v->start == v->end)
+  {
+    begin_op();
+    iput(v->ip);
+    end_op();
+    memset(v, 0, sizeof(*v));
+  }
+  return 0;
+}
+
+// Tear down every region of p, e.g. on exit or exec.
+void munmapall(struct proc *p) {
+  struct shmseg *seg;
+
+  for (int i = 0; i < NVMA; i++)
+  {
+    if (p->vmas[i].end == 0)
+      continue;
+    if ((seg = p->vmas[i].shm) != 0)
+    {
+      unmapsegment(p, &p->vmas[i]);
+      shmrelease(seg);
+    }
+    else if (p->vmas[i].start < MMAPBASE)
+    {
+      // A program segment: its pages lie below sz and are
+      // freed with the rest of the image by freevm().
+      begin_op();
+      iput(p->vmas[i].ip);
+      end_op();
+      memset(&p->vmas[i], 0, sizeof(p->vmas[i]));
+    }
+    else
+      munmapfile(p, p->vmas[i].start, p->vmas[i].end - p->vmas[i].start);
+  }
+}
+
+// Shared memory.
+//
+// Segment frames are mapped present with PTE_SH. They are never put
+// on the process's FIFO/aging lists, so page replacement and the
+// per-process swap file leave them alone; fork maps the same frames
+// in the child, and every mapping holds a reference to each frame.
+
+// Map every page of seg into p. Returns the address, or -1.
+int mapsegment(struct proc *p, struct shmseg *seg) {
+  struct vma *v;
+  uint start, a;
+
+  if ((v = vmaalloc(p, seg->npages * PGSIZE, &start)) == 0)
+    return -1;
+  for (int i = 0; i < seg->npages; i++)
+  {
+    a = start + i * PGSIZE;
+    if (mappages(p->pgdir, (char *)a, PGSIZE, V2P(seg->pages[i]), PTE_W | PTE_U | PTE_SH) < 0)
+    {
+      while (a > start)
+      {
+        a -= PGSIZE;
+        *walkpgdir(p->pgdir, (char *)a, 0) = 0;
+        kfree(seg->pages[(a - start) / PGSIZE]);
+      }
+      return -1;
+    }
+    kincref(seg->pages[i]);
+  }
+
+  v->start = start;
+  v->end = start + seg->npages * PGSIZE;
+  v->off = 0;
+  v->filesz = 0;
+  v->prot = PROT_READ | PROT_WRITE;
+  v->flags = MAP_SHARED;
+  v->ip = 0;
+  v->shm = seg;
+  return start;
+}
+
+// Remove the mapping of a segment from p. The caller drops
+// the attachment with shmrelease().
+void unmapsegment(struct proc *p, struct vma *v) {
+  pte_t *pte;
+
+  for (uint a = v->start; a < v->end; a += PGSIZE)
+  {
+    if ((pte = walkpgdir(p->pgdir, (char *)a, 0)) == 0)
+      continue;
+    if (*pte & PTE_P)
+      kfree(P2V(PTE_ADDR(*pte)));
+    *pte = 0;
+  }
+  lcr3(V2P(p->pgdir));
+  memset(v, 0, sizeof(*v));
 }